@@ -1,20 +1,34 @@
 /* TODO:
- *   variable audio format (not hardcoded to 16bit mono)
- *   dynamic allocate audio buffer rather than set max
- *   fix crash on resize while playing
+ *   keep samples at more than 16 bits instead of converting everything to 16 bit
  *   rendering optimizations:
  *     hardware accelerate the waveform rendering
- *     only rerender damaged areas
- *     drop redundant ui events? like mouse motion?
- *     vsync the playback animation
  */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <SDL2/SDL.h>
+#ifdef WAVY_LIBAV
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswresample/swresample.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#define X86_KERNELS 1
+#include <immintrin.h>
+#endif
 
 #define min(a, b)				\
   ({ __typeof__ (a) _a = (a);			\
@@ -28,15 +42,80 @@
 // constants
 #define WINDOW_WIDTH 600
 #define WINDOW_HEIGHT 200
-#define MAX_SAMPLES 1024 * 1024 * 64
+#define SAMPLE_CHUNK_SHIFT 16
+#define MAX_LENGTH ((int64_t)1 << 40) // most frames a buffer can hold, only the pages of the chunk index in use get allocated
+#define INDEX_PAGE_SHIFT 10 // chunks in each page of a chunked array's index as a power of two
+#define SUMMARY_BLOCK_SIZE 256
+#define SUMMARY_CHUNK_SHIFT 10
+#define LOAD_BLOCK_SIZE 1024 * 64
+#define LOAD_PROGRESS_INTERVAL 100
+#define CONVERT_BLOCK_SIZE 1024
+#define MIN_SEGMENT_DURATION 60 // seconds of audio worth starting another ffmpeg for
+#define SEGMENT_PREROLL 1 // seconds decoded before a segment and thrown away so the codec has settled
 #define SCROLL_PAN_SCALE 8
 #define SCROLL_ZOOM_SCALE 0.1
 #define KEY_STEP_SCALE 10
 #define KEY_PAN_SCALE 30
 #define KEY_ZOOM_SCALE 0.15
-#define PLAY_BUFFER_SIZE 1024
-#define ASYNC_PLAY_ANIMATION 0
+#define DEFAULT_LATENCY 10 // milliseconds of audio to ask the device for at a time to start with
+#define MIN_PLAY_BUFFER_SIZE 64
+#define MAX_PLAY_BUFFER_SIZE 8192
+#define MAX_DEVICE_CHANNELS 8 // most channels sdl will open a device with
+#define ADAPT_INTERVAL 1000 // milliseconds between looking at whether the device buffer should grow
+#define ADAPT_UNDERRUNS 2 // underruns in one interval that make it grow
+#define PLAY_ANIMATION_INTERVAL 16
+#define RATE_SHIFT 16 // playback rates and positions between frames are fixed point with this many fraction bits
+#define MIN_PLAYBACK_RATE 0.25
+#define MAX_PLAYBACK_RATE 4.0
+#define INTERPOLATE_SHIFT 14 // fraction bits of the weights frames are interpolated with
+#define INTERPOLATE_SAMPLES 1024 // samples interpolated at a time when playing at another rate
+#define MAX_DAMAGE_SPANS 8
+#define DRAW_BATCH_COLUMNS 256
+#define MIN_BAND_COLUMNS 64 // narrowest band of columns worth handing to another thread
 #define EXPORT_FILE_NAME "~/tmp.mp3"
+#define MAX_RUNNING_EXPORTS 4
+#define CACHE_FORMAT "s16le-native-2"
+#define CACHE_HEADER_SIZE 4096
+#define STATS_BUCKETS 24
+#define STATS_OVERLAY_INTERVAL 250
+#define STATS_LINES 6
+#define STATS_LINE_LENGTH 48
+#define FONT_WIDTH 3
+#define FONT_HEIGHT 5
+#define FONT_SCALE 2
+#define FONT_CHARACTERS "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/%-"
+#define DEFAULT_CACHE_SIZE 4096
+#define PAGE_PREFETCH 8 // chunks of samples asked for ahead of the playhead when they're in a file
+#define SPECTRUM_SIZE 1024 // frames in each fft, a power of two
+#define SPECTRUM_BANDS 128 // frequency bands each channel of the spectrogram is split into, spaced logarithmically
+#define SPECTRUM_RANGE 96 // decibels below full scale the spectrogram colors go down to
+#define SPECTRUM_TILE_COLUMNS 64 // spectrogram columns computed at a time
+#define SPECTRUM_TILES 512 // spectrogram tiles kept around
+#define SPECTRUM_LEVEL_SEARCH 8 // how many zoom levels either way to look for a tile to show until the right one is ready
+#define RENDER_WIDTH 1024 // size of rendered waveform pngs unless asked for another
+#define RENDER_HEIGHT 256
+#define RENDER_FORMAT SDL_PIXELFORMAT_RGB888
+#define RENDER_POLL_INTERVAL 10 // milliseconds between dropping what the loader went through while rendering a long file
+
+// enum for the ways the rms of a waveform column can be found
+enum rmsMode
+  {
+    RMS_SCAN, // add up every sample
+    RMS_SUMMARY, // use the summary pyramid
+    RMS_PREFIX // use the prefix sums of squares
+  };
+
+// how the samples of an uncompressed file are stored
+enum sampleEncoding
+  {
+    ENCODING_U8,
+    ENCODING_S8,
+    ENCODING_S16,
+    ENCODING_S24,
+    ENCODING_S32,
+    ENCODING_F32,
+    ENCODING_F64
+  };
 
 // enum for abstract user input target
 enum target
@@ -53,23 +132,153 @@ enum action
     SECONDARY
   };
 
+// enum for the kinds of work timed while instrumenting
+enum timingKind
+  {
+    TIMING_FRAME, // a whole redrawScreen
+    TIMING_DRAW_WAVEFORM, // rendering the stale columns
+    TIMING_SET_TARGET, // a setTargetValues
+    TIMING_REQUEST_AUDIO, // one audio callback
+    TIMING_AUDIO_INTERVAL, // from the start of one audio callback to the next
+    TIMING_KEY_EVENT,
+    TIMING_MOTION_EVENT,
+    TIMING_BUTTON_EVENT,
+    TIMING_WHEEL_EVENT,
+    TIMING_WINDOW_EVENT,
+    TIMING_LOAD_EVENT,
+    TIMING_KINDS
+  };
+
+// a set of sample crunching routines for one instruction set
+struct kernels
+{
+  const char* name;
+  int (*supported)();
+  int64_t (*sumOfSquares)(const int16_t* samples, int length);
+  void (*minMax)(const int16_t* samples, int length, int16_t* min, int16_t* max);
+  void (*convertFloats)(const float* floats, int length, int16_t* samples);
+  void (*interpolate)(const int16_t* pairs, const int16_t* weights, int length, int16_t* samples);
+  void (*window)(const int16_t* samples, const float* window, int length, float* windowed);
+};
+
+// how long one kind of work took over a run
+// in performance counter ticks
+// each kind is only added to from one thread but can be read from any
+struct timing
+{
+  Uint64 count;
+  Uint64 total;
+  Uint64 min;
+  Uint64 max;
+  Uint64 histogram[STATS_BUCKETS]; // counts by how many bits the time in microseconds takes
+};
+
+// counters and such that arent timings
+struct stats
+{
+  Uint64 deadline; // ticks worth of audio the device asks for in each callback
+  Uint64 lastCallback; // when the last audio callback started, 0 if playback was paused
+  Uint64 underruns; // callbacks that came later than the last buffer could have lasted
+  Uint64 starved; // callbacks that ran out of loaded audio to play
+  Uint64 events; // events processed
+  Uint64 rateEvents; // events processed when the rate was last worked out
+  Uint32 rateStart; // when the rate was last worked out
+  double eventsPerSecond;
+  char overlay[STATS_LINES][STATS_LINE_LENGTH]; // text of the overlay
+  int overlayWidth; // columns the overlay covers
+  int overlayChanged; // set when the text changed since it was last put on the screen
+  Uint32 overlayFormatted; // when the text was last worked out
+};
+
 // global vars
 struct cliArgs cliArgs; // to hold the cli args
+struct kernels kernels; // the sample kernels picked for this cpu
 struct audioBuffer audioBuffer; // to hold the loaded audio
+struct summary summary; // multi-resolution summary of the loaded audio
+struct loader loader; // background loader filling in the audio buffer
+struct pager pager; // keeps paged samples within the memory budget
+struct playlist playlist; // the files being gone through and the next one loading ahead
+struct workerPool workers; // threads the waveform gets drawn with
+struct spectrogram spectrogram; // spectrogram tiles and the threads computing them
+int showSpectrogram; // whether the spectrogram is showing instead of the waveform
+Uint32 spectrumEvent; // sdl event type sent as spectrogram tiles are finished
+struct exportJob* exports; // unfinished exports, oldest first
+int exportCount; // exports started so far
+Uint32 exportProgressEvent; // sdl event type sent as exports make progress
+Uint32 loadProgressEvent; // sdl event type sent as the loader makes progress
 SDL_AudioDeviceID audioDevice; // sdl audio device id
+int playBufferSize; // frames the audio device asks for in each callback
+int deviceChannels; // channels the audio device plays
+int audioChannels; // channels of the audio it was opened for
+int16_t* mixBuffer; // where the audio is put before being mixed to the device channels
+Uint64 adaptedUnderruns; // underruns there had been when the buffer size was last looked at
+Uint32 adaptedTime; // when that was
 
 // user input related state
-int playPosition; // current sample
+struct transport transport; // playback state shared with the audio callback
+int64_t drawnPosition; // play position the screen was last drawn with
 struct region selection; // currently selected portion
 struct region viewport; // currently viewed portion of audio
+int64_t wholeLength; // the length of the whole file when the viewport was last fit to it
 enum action selectionGrabbedPole; // currently grabbed end
 int looping; // currently looping or not
 int playing; // currently playing or not
+double playbackRate; // the rate the interface last asked for
 
 // sdl resources
 SDL_Window* mainWindow; // main window
 SDL_Surface* mainSurface; // surface of the main window
 
+// trace recording and replaying
+FILE* traceFile; // the trace being recorded or replayed, if any
+Uint32 traceStart; // ticks when the trace started
+struct modifiers replayModifiers; // modifier keys held during the event being replayed
+int replayMouseX; // where the mouse was during the event being replayed
+
+// instrumentation
+int instrumenting; // whether timings and counters are being kept
+int showStats; // whether the stats overlay is showing
+volatile sig_atomic_t statsDumpRequested; // set by SIGUSR1 to dump the stats
+struct timing timings[TIMING_KINDS]; // how long things took
+const char* timingNames[TIMING_KINDS] = { "frame", "drawWaveform", "setTargetValues", "requestAudio",
+					  "audioInterval", "keyEvent", "motionEvent", "buttonEvent",
+					  "wheelEvent", "windowEvent", "loadEvent" };
+struct stats stats; // everything else that gets counted
+
+// frame pacing
+int frameInterval; // milliseconds between frames of the display
+int redrawRequested; // set when something changed that needs showing
+Uint32 lastFrame; // when the screen was last redrawn
+
+// what is on the screen right now
+struct palette palette; // waveform colors mapped for the last surface format drawn to
+struct spectrumPalette spectrumPalette; // spectrogram colors mapped for the last surface format drawn to
+SDL_Surface* waveformLayer; // rendered waveform without the playhead on it
+SDL_Surface* stretchLayer; // the waveform layer gets stretched into this when zooming, then they swap
+struct damage staleColumns; // columns of the waveform layer that need rendering again
+struct damage roughColumns; // columns of the waveform layer only showing a stretched copy of another zoom
+struct damage dirtyColumns; // columns of the window that need copying from the layer
+struct columnSpan drawnPlayhead; // columns the playhead was last drawn over
+struct region drawnSelection; // selection the waveform layer was rendered with
+struct region drawnViewport; // viewport the waveform layer was rendered with
+int64_t drawnLength; // how much audio was loaded when the waveform layer was rendered
+
+// playback state shared between the interface and the audio callback
+// only ever accessed atomically so neither side waits on the other
+struct transport
+{
+  int64_t position; // current sample, published by the callback
+  int64_t seekPosition; // where the interface wants playback to jump to
+  int seekPending; // set when theres a seek for the callback to pick up
+  int ended; // set by the callback when playback ran off the end
+  int rate; // how fast to play, RATE_SHIFT fixed point
+  int reversed; // play backwards
+  int fraction; // how far between frames playback is, only touched by the callback
+  struct audioBuffer* buffer; // a fully loaded buffer to play instead of the loading one, NULL to play that
+  struct audioBuffer* next; // a fully loaded buffer to carry straight on into at the end, NULL if theres none
+  int switched; // set by the callback when it carried on into the next buffer
+};
+
 // a structure representing which modifier keys are held
 struct modifiers
 {
@@ -81,32 +290,373 @@ struct modifiers
 // a structure to represent the primary and secondary values of a user input target
 struct targetValues
 {
-  int primary;
-  int secondary;
+  int64_t primary;
+  int64_t secondary;
 };
 
 // a structure to represent a region of audio
 struct region
 {
-  int start; // leftmost sample (inclusive)
-  int stop; // rightmost sample (exclusive)
+  int64_t start; // leftmost sample (inclusive)
+  int64_t stop; // rightmost sample (exclusive)
+};
+
+// a span of columns of the window
+struct columnSpan
+{
+  int start; // leftmost column (inclusive)
+  int stop; // rightmost column (exclusive)
+};
+
+// the colors of the waveform already mapped to a surface format
+struct palette
+{
+  Uint32 format; // pixel format these were mapped for
+  Uint32 filled; // waveform outside of the selection
+  Uint32 unfilled; // background outside of the selection
+  Uint32 selectedFilled; // waveform inside of the selection
+  Uint32 selectedUnfilled; // background inside of the selection
+  Uint32 playhead; // the play position cursor
+};
+
+// a set of column spans that need drawing again
+struct damage
+{
+  int count;
+  struct columnSpan spans[MAX_DAMAGE_SPANS];
+};
+
+// an array made of fixed size chunks that are allocated as they're needed
+// chunks never move once allocated so it can be read from while it grows
+// the index of them is in pages that are allocated as they're needed too and never move either
+// so a huge capacity only costs a small table of pages up front
+struct chunkedArray
+{
+  char*** index; // pages of the index of the chunks, NULL where not allocated yet
+  int chunkCount; // most chunks it can have
+  int shift; // elements per chunk as a power of two
+  int elementSize;
+  char* mapping; // a mapped file the chunks point into instead, if any
+  size_t mappingSize;
+  int fd; // a file each chunk gets mapped from as its needed instead of being allocated, -1 if none
+  off_t fileOffset; // where the first chunk starts in that file
 };
 
 // a structure to hold audio data
+// positions and lengths are all in frames, one sample for each channel
 struct audioBuffer
 {
-  int16_t* buffer;
-  int length;
+  struct chunkedArray samples; // interleaved frames
+  int64_t length;
+  int channels;
+  int sampleRate;
+  SDL_AudioFormat format; // format of each sample
+  struct chunkedArray squareSums; // sum of squares of each channel before each frame, if kept
+  int* references; // how many holders of the samples there are, they go once nobody holds them
+};
+
+// where the samples are in an uncompressed file and what they look like
+struct pcmFormat
+{
+  enum sampleEncoding encoding;
+  int bigEndian;
+  int channels;
+  int sampleRate;
+  off_t offset; // where the first frame starts
+  off_t length; // frames
+};
+
+// what ffprobe says about the audio in a file
+struct audioInfo
+{
+  int channels;
+  int sampleRate;
+  double duration; // seconds, 0 if unknown
+};
+
+// the header at the start of a cache entry
+// padded out to a page so the samples after it can be mapped straight in
+struct cacheHeader
+{
+  char format[16]; // CACHE_FORMAT of whoever wrote it
+  int32_t channels;
+  int32_t sampleRate;
+};
+
+// summary of a block of audio samples
+struct summaryBlock
+{
+  int64_t sumOfSquares;
+  int16_t min;
+  int16_t max;
+};
+
+// one resolution level of an audio summary
+struct summaryLevel
+{
+  int64_t blockSize; // frames per block (power of two)
+  int64_t length; // number of complete blocks
+  struct chunkedArray blocks;
+};
+
+// a pyramid of summaries at successively doubling block sizes
+// every block has a summary for each channel
+struct summary
+{
+  int levels;
+  int channels;
+  struct summaryLevel* level;
+};
+
+#ifdef WAVY_LIBAV
+// state of decoding a file in process with libav
+struct decoder
+{
+  AVFormatContext* format;
+  AVCodecContext* codec;
+  SwrContext* resampler; // only made if the codec doesnt give out interleaved 16 bit samples itself
+  AVPacket* packet;
+  AVFrame* frame;
+  int stream;
+  int channels;
+  int16_t* pending; // frames decoded but not taken yet
+  int pendingCapacity;
+  int pendingStart;
+  int pendingLength;
+  int flushed; // there are no more packets so the codec was told to finish up
+  int ended; // the codec has given out its last frame
+  int failed; // the file couldnt be read all the way through
+};
+#endif
+
+// one piece of a file decoded by its own ffmpeg alongside the others
+struct segment
+{
+  SDL_Thread* thread;
+  FILE* pipe;
+  pid_t process; // the ffmpeg writing to the pipe
+  struct loader* loader;
+  int64_t start; // first frame of the buffer it fills in
+  int64_t length; // frames it fills in, the last one goes on for as long as ffmpeg does
+  int64_t decoded; // frames filled in so far, updated atomically
+  int done; // set once it has stopped
+  int complete; // whether ffmpeg got all the way through it
+};
+
+// state of the background thread reading audio from ffmpeg
+struct loader
+{
+  SDL_Thread* thread;
+  SDL_sem* started; // posted once there are samples to show or the loader gave up
+  FILE* pipe; // ffmpeg output, NULL when the samples came from the cache or straight from the file
+  pid_t process; // the ffmpeg writing to the pipe
+  struct decoder* decoder; // decoding in process instead of through ffmpeg, if built with libav
+  struct segment* segments; // pieces of a long file being decoded all at once instead of through one pipe
+  int segmentCount;
+  SDL_sem* segmentProgress; // posted whenever a segment gets further
+  int segmentsStopped; // set to make the segments stop early
+  const Uint8* source; // a mapped uncompressed file whose samples need converting, if any
+  size_t sourceSize;
+  struct pcmFormat sourceFormat;
+  FILE* cacheFile; // where the decoded samples are being cached, if anywhere
+  char cachePath[PATH_MAX];
+  char cacheTempPath[PATH_MAX];
+  struct audioBuffer* buffer;
+  struct summary* summary;
+  int64_t expectedLength; // total samples expected from the file, 0 if unknown
+  int done; // set once the whole file has been read
+  int cancelled; // set to make the loader stop early
+  int paged; // the samples go straight into a file so they dont get written to the cache separately
+  Uint32 lastProgress; // when the last progress event was sent
+};
+
+// keeps the samples that are resident in memory within a budget when they're in a file
+// chunks around the playhead and the viewport are asked for ahead of time
+// and the ones wanted longest ago get dropped once too many are resident
+// only the interface thread touches it, the kernel pages chunks back in if anyone else wants them
+struct pager
+{
+  Uint32* wanted; // when each chunk was last wanted, 0 if it isnt thought to be resident
+  int64_t size; // chunks there is room for in wanted, it grows along with the samples
+  int64_t budget; // most chunks to keep resident
+  int64_t resident; // chunks thought to be resident
+  int64_t loaded; // complete chunks the loader has been through
+  Uint32 clock; // bumped every time the pager runs
+};
+
+// the files being gone through, with the one after the current one loaded ahead of time
+// it gets loaded into a buffer of its own in the background while the current one plays
+// and once its all there a copy goes to the audio callback so playback can carry straight on into it
+struct playlist
+{
+  int current; // which file is showing
+  int next; // which file is being loaded ahead, -1 if none
+  SDL_Thread* prefetch; // loads the next file, NULL once its been waited for
+  int prefetched; // set by the prefetch thread, 1 once the whole file is loaded or -1 if it couldnt be
+  int cancelled; // set to make the prefetch give up
+  int skip; // which way along the playlist the interface wants to go, 0 to stay
+  int play; // whether to play the file skipped to
+  struct audioBuffer buffer; // the next file
+  struct summary summary;
+  struct loader loader;
+  struct audioBuffer handoffs[2]; // copies for the callback, one it might be playing and one to give it next
+};
+
+// a run of spectrogram columns at one zoom level
+// column i is centered on frame (index * SPECTRUM_TILE_COLUMNS + i) << level
+struct spectrumTile
+{
+  int level;
+  int64_t index;
+  int64_t length; // frames there were when its pixels were computed, 0 if they havent been
+  int queued; // waiting for a thread to compute it
+  int priority; // lower ones get computed first
+  int running; // a thread is computing it
+  int cancelled; // set when its no longer wanted while a thread is on it
+  Uint32 used; // when the interface last wanted it
+  Uint8* pixels; // how loud each band of each channel is, a row of columns per band
+};
+
+// the spectrogram tile cache and the threads that fill it in
+// the interface asks for the tiles it's showing every time it draws and the threads do the most central first
+// everything but the pixels a thread is computing is guarded by the lock
+struct spectrogram
+{
+  int threads;
+  SDL_Thread** workers;
+  SDL_mutex* lock;
+  SDL_cond* wake; // signalled when there are tiles to compute or its time to quit
+  int quit;
+  int channels; // the pixels of every tile have room for this many
+  Uint32 clock; // bumped every time the interface asks for tiles
+  struct spectrumTile tiles[SPECTRUM_TILES];
+  float window[SPECTRUM_SIZE]; // hann window
+  float twiddles[SPECTRUM_SIZE]; // e^-2pi*i*k/(SPECTRUM_SIZE / 2) for the complex fft, interleaved
+  float split[SPECTRUM_SIZE + 2]; // e^-2pi*i*k/SPECTRUM_SIZE for splitting it into the real one, interleaved
+  int bands[SPECTRUM_BANDS + 1]; // first fft bin of each band
+};
+
+// spectrogram colors already mapped to a surface format
+struct spectrumPalette
+{
+  Uint32 format;
+  Uint32 colors[256]; // by loudness
+  Uint32 selectedColors[256]; // inside of the selection
+};
+
+// persistent threads that work through bands of a job together
+// the job is handed out in numbered bands and whoever is free takes the next one
+struct workerPool
+{
+  int threads; // including the thread that hands out the job
+  SDL_Thread** workers;
+  SDL_mutex* lock;
+  SDL_cond* wake; // signalled when there is a new job or its time to quit
+  SDL_cond* finished; // signalled when the last worker is done with a job
+  int generation; // bumped for every new job
+  int pending; // workers still on the current job
+  int quit;
+  void (*job)(void* data, int band);
+  void* data;
+  int bands;
+  int nextBand; // taken atomically
+};
+
+// a region of audio being written out to a file by ffmpeg in the background
+// it holds a reference to the samples rather than a copy of them
+struct exportJob
+{
+  struct audioBuffer buffer;
+  int64_t start;
+  int64_t stop;
+  char path[PATH_MAX];
+  SDL_Thread* thread; // NULL while waiting for its turn
+  int64_t written; // frames written so far, updated atomically
+  int done; // set once the export has finished, successfully or not
+  Uint32 lastProgress; // when the last progress event was sent
+  struct exportJob* next;
 };
 
 // structure to hold the cli args
 struct cliArgs
 {
-  char* filename;
+  const char* filename; // the first file
+  const char** filenames; // every file to go through, in order
+  int fileCount;
   int autoplay;
   int autoloop;
+  enum rmsMode rmsMode;
+  const char* kernels;
+  int checkKernels;
+  int cache;
+  int cacheSize; // megabytes
+  const char* recordTrace; // file to record the events into
+  const char* replayTrace; // file to replay the events from
+  int stats; // keep stats and dump them at exit
+  int threads; // threads to draw with, 0 for one per cpu
+  const char* exportPath; // where to export to, %d gets the number of the export
+  const char* raw; // how a headerless file is laid out, ENCODING:CHANNELS:RATE
+  int segments; // most ffmpegs to decode a long file with at once, 0 for one per cpu
+  double rate; // how fast to play to start with
+  double latency; // milliseconds of audio the device should ask for at a time to start with
+  int bufferSize; // frames the device should ask for at a time, pinned, 0 to adapt
+  int memory; // megabytes of samples to keep in memory, 0 for half of it
+  int spectrogram; // start out showing the spectrogram
+  const char* renderPath; // render waveform pngs here instead of opening a window, %d and %s get the number and name of each file
+  int renderWidth;
+  int renderHeight;
 };
 
+// add a file to the ones to go through
+int addFile(struct cliArgs* cliArgs, const char* filename)
+{
+  const char** filenames = (const char**)realloc(cliArgs->filenames, sizeof(char*) * (cliArgs->fileCount + 1));
+  if(filenames == NULL) return -1;
+  filenames[cliArgs->fileCount++] = filename;
+  cliArgs->filenames = filenames;
+  cliArgs->filename = filenames[0];
+  return 0;
+}
+
+// add the files listed in a playlist, one to a line
+// blank lines and ones starting with # are skipped so m3u files work too
+// paths that arent absolute are taken from where the playlist is
+int readPlaylist(struct cliArgs* cliArgs, const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if(file == NULL)
+    {
+      fprintf(stderr, "Could not open playlist %s!\n", path);
+      return -1;
+    }
+  const char* slash = strrchr(path, '/');
+  size_t directory = slash != NULL ? slash - path + 1 : 0;
+  char line[PATH_MAX];
+  int failed = 0;
+  while(!failed && fgets(line, sizeof(line), file) != NULL)
+    {
+      size_t length = strcspn(line, "\r\n");
+      line[length] = '\0';
+      if(length == 0 || line[0] == '#') continue;
+      char* filename = (char*)malloc(directory + length + 1);
+      if(filename == NULL)
+	{
+	  failed = -1;
+	  break;
+	}
+      size_t prefix = line[0] == '/' ? 0 : directory;
+      memcpy(filename, path, prefix);
+      strcpy(filename + prefix, line);
+      failed = addFile(cliArgs, filename);
+      if(failed) free(filename);
+    }
+  fclose(file);
+  // running out of memory part way through shouldnt look like a shorter playlist
+  if(failed)
+    fprintf(stderr, "Could not allocate the files of playlist %s!\n", path);
+  return failed;
+}
+
 // load a cli arg struct with actual cli args
 int loadCliArgs(struct cliArgs* cliArgs, int argc, const char* argv[])
 {
@@ -129,19 +679,110 @@ int loadCliArgs(struct cliArgs* cliArgs, int argc, const char* argv[])
       // no auto play
       else if(strcmp(arg, "-np") == 0)
 	cliArgs->autoplay = 0;
-      // filename
-      else
+      // how to calculate the waveform
+      else if(strcmp(arg, "--rms") == 0 && i + 1 < argc)
 	{
-	  // just grab the rest of the args as a whole string
-	  cliArgs->filename = (char*)malloc(512);
-	  int j;
-	  for(j = i; j < argc; j++)
-	    {
-	      if(i == j) strcpy(cliArgs->filename, argv[j]);
-	      else strcat(cliArgs->filename, argv[j]);
-	    }
-	  break;
+	  const char* mode = argv[++i];
+	  if(strcmp(mode, "scan") == 0)
+	    cliArgs->rmsMode = RMS_SCAN;
+	  else if(strcmp(mode, "summary") == 0)
+	    cliArgs->rmsMode = RMS_SUMMARY;
+	  else if(strcmp(mode, "prefix") == 0)
+	    cliArgs->rmsMode = RMS_PREFIX;
+	  else return -1;
+	}
+      // force a particular set of sample kernels
+      else if(strcmp(arg, "--kernel") == 0 && i + 1 < argc)
+	cliArgs->kernels = argv[++i];
+      // compare the sample kernels against each other and quit
+      else if(strcmp(arg, "--check-kernels") == 0)
+	cliArgs->checkKernels = 1;
+      // dont use the decoded audio cache
+      else if(strcmp(arg, "--no-cache") == 0)
+	cliArgs->cache = 0;
+      // how big the decoded audio cache can get
+      else if(strcmp(arg, "--cache-size") == 0 && i + 1 < argc)
+	cliArgs->cacheSize = atoi(argv[++i]);
+      // record the events into a trace file
+      else if(strcmp(arg, "--record-trace") == 0 && i + 1 < argc)
+	cliArgs->recordTrace = argv[++i];
+      // replay the events from a trace file without a window and time everything
+      else if(strcmp(arg, "--replay-trace") == 0 && i + 1 < argc)
+	cliArgs->replayTrace = argv[++i];
+      // show the spectrogram instead of the waveform to start with
+      else if(strcmp(arg, "--spectrogram") == 0)
+	cliArgs->spectrogram = 1;
+      // keep stats on how long things take
+      else if(strcmp(arg, "--stats") == 0)
+	cliArgs->stats = 1;
+      // how many threads to draw with
+      else if(strcmp(arg, "--threads") == 0 && i + 1 < argc)
+	{
+	  cliArgs->threads = atoi(argv[++i]);
+	  if(cliArgs->threads < 1)
+	    return -1;
+	}
+      // read the file as headerless samples
+      else if(strcmp(arg, "--raw") == 0 && i + 1 < argc)
+	cliArgs->raw = argv[++i];
+      // how many pieces to decode long files in
+      else if(strcmp(arg, "--segments") == 0 && i + 1 < argc)
+	{
+	  cliArgs->segments = atoi(argv[++i]);
+	  if(cliArgs->segments < 1)
+	    return -1;
+	}
+      // how fast to play
+      else if(strcmp(arg, "--rate") == 0 && i + 1 < argc)
+	{
+	  cliArgs->rate = atof(argv[++i]);
+	  if(cliArgs->rate < MIN_PLAYBACK_RATE || cliArgs->rate > MAX_PLAYBACK_RATE)
+	    return -1;
 	}
+      // how much audio the device should ask for at a time
+      else if(strcmp(arg, "--latency") == 0 && i + 1 < argc)
+	{
+	  cliArgs->latency = atof(argv[++i]);
+	  if(cliArgs->latency <= 0)
+	    return -1;
+	}
+      // the same but in frames and never changed
+      else if(strcmp(arg, "--buffer-size") == 0 && i + 1 < argc)
+	{
+	  cliArgs->bufferSize = atoi(argv[++i]);
+	  if(cliArgs->bufferSize < MIN_PLAY_BUFFER_SIZE || cliArgs->bufferSize > MAX_PLAY_BUFFER_SIZE)
+	    return -1;
+	}
+      // how much of the samples to keep in memory
+      else if(strcmp(arg, "--memory") == 0 && i + 1 < argc)
+	{
+	  cliArgs->memory = atoi(argv[++i]);
+	  if(cliArgs->memory < 1)
+	    return -1;
+	}
+      // where exported snippets go
+      else if(strcmp(arg, "--export") == 0 && i + 1 < argc)
+	cliArgs->exportPath = argv[++i];
+      // render waveforms to pngs without a window
+      else if(strcmp(arg, "--render-png") == 0 && i + 1 < argc)
+	cliArgs->renderPath = argv[++i];
+      // how big to render them
+      else if(strcmp(arg, "--size") == 0 && i + 1 < argc)
+	{
+	  if(sscanf(argv[++i], "%dx%d", &cliArgs->renderWidth, &cliArgs->renderHeight) != 2 ||
+	     cliArgs->renderWidth < 1 || cliArgs->renderHeight < 1)
+	    return -1;
+	}
+      // files listed in a playlist
+      else if(strcmp(arg, "--playlist") == 0 && i + 1 < argc)
+	{
+	  if(readPlaylist(cliArgs, argv[++i]))
+	    return -1;
+	}
+      // anything else is a file to play
+      // with more than one they get gone through in order
+      else if(addFile(cliArgs, arg))
+	return -1;
     }
 
   // all was good
@@ -153,11 +794,38 @@ int processCommandLineArgs(int argc, const char* argv[])
 {
   // the default values
   cliArgs.filename = NULL;
+  cliArgs.filenames = NULL;
+  cliArgs.fileCount = 0;
   cliArgs.autoplay = 1;
-  cliArgs.autoloop = 1;
+  cliArgs.autoloop = -1;
+  cliArgs.rmsMode = RMS_SUMMARY;
+  cliArgs.kernels = NULL;
+  cliArgs.checkKernels = 0;
+  cliArgs.cache = 1;
+  cliArgs.cacheSize = DEFAULT_CACHE_SIZE;
+  cliArgs.recordTrace = NULL;
+  cliArgs.replayTrace = NULL;
+  cliArgs.stats = 0;
+  cliArgs.threads = 0;
+  cliArgs.exportPath = EXPORT_FILE_NAME;
+  cliArgs.raw = NULL;
+  cliArgs.segments = 0;
+  cliArgs.rate = 1;
+  cliArgs.latency = DEFAULT_LATENCY;
+  cliArgs.bufferSize = 0;
+  cliArgs.memory = 0;
+  cliArgs.spectrogram = 0;
+  cliArgs.renderPath = NULL;
+  cliArgs.renderWidth = RENDER_WIDTH;
+  cliArgs.renderHeight = RENDER_HEIGHT;
 
   // load values from cli
-  return loadCliArgs(&cliArgs, argc, argv);
+  if(loadCliArgs(&cliArgs, argc, argv)) return -1;
+
+  // looping is on by default unless theres a playlist to go through
+  if(cliArgs.autoloop < 0)
+    cliArgs.autoloop = cliArgs.fileCount <= 1;
+  return 0;
 }
 
 // setup sdl stuff
@@ -167,6 +835,13 @@ int initSDL()
   mainWindow = NULL;
   mainSurface = NULL;
   
+  // replaying runs headless with an offscreen window and dummy audio
+  if(cliArgs.replayTrace != NULL)
+    {
+      SDL_setenv("SDL_VIDEODRIVER", "offscreen", 1);
+      SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+    }
+
   // setup sdl subsystems
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
     {
@@ -203,16 +878,126 @@ void cleanupSDL()
   SDL_Quit();
 }
 
+// start timing something
+// only when instrumenting, otherwise this costs next to nothing
+// returns 0 when not timing
+Uint64 startTiming()
+{
+  return __atomic_load_n(&instrumenting, __ATOMIC_RELAXED) ? SDL_GetPerformanceCounter() : 0;
+}
+
+// add a time to the timings of a kind of work
+void addTiming(enum timingKind kind, Uint64 elapsed)
+{
+  struct timing* timing = &timings[kind];
+  Uint64 microseconds = elapsed * 1000000 / SDL_GetPerformanceFrequency();
+  int bucket = microseconds == 0 ? 0 : min(64 - __builtin_clzll(microseconds), STATS_BUCKETS - 1);
+  Uint64 count = __atomic_load_n(&timing->count, __ATOMIC_RELAXED);
+  if(count == 0 || elapsed < __atomic_load_n(&timing->min, __ATOMIC_RELAXED))
+    __atomic_store_n(&timing->min, elapsed, __ATOMIC_RELAXED);
+  if(elapsed > __atomic_load_n(&timing->max, __ATOMIC_RELAXED))
+    __atomic_store_n(&timing->max, elapsed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&timing->total, elapsed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&timing->histogram[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&timing->count, count + 1, __ATOMIC_RELAXED);
+}
+
+// add the time since startTiming to the timings of a kind of work
+void stopTiming(enum timingKind kind, Uint64 started)
+{
+  if(started == 0) return;
+  addTiming(kind, SDL_GetPerformanceCounter() - started);
+}
+
+// convert timing ticks to milliseconds
+double tickMilliseconds(Uint64 ticks)
+{
+  return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// get roughly the time in milliseconds that a fraction of the timings came in under
+// its the top of the histogram bucket that fraction reaches, or the slowest time if thats less
+double timingPercentile(struct timing* timing, double fraction)
+{
+  Uint64 count = __atomic_load_n(&timing->count, __ATOMIC_RELAXED);
+  double slowest = tickMilliseconds(__atomic_load_n(&timing->max, __ATOMIC_RELAXED));
+  Uint64 seen = 0;
+  int i;
+  for(i = 0; i < STATS_BUCKETS; i++)
+    {
+      seen += __atomic_load_n(&timing->histogram[i], __ATOMIC_RELAXED);
+      if(seen > 0 && seen >= fraction * count)
+	return min((1ULL << i) / 1000.0, slowest);
+    }
+  return slowest;
+}
+
+// how much memory is resident right now in bytes
+long long residentMemory()
+{
+  FILE* file = fopen("/proc/self/statm", "r");
+  if(file == NULL) return 0;
+  long long size, resident;
+  if(fscanf(file, "%lld %lld", &size, &resident) != 2) resident = 0;
+  fclose(file);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// how many bytes of samples can be kept in memory
+// either what was asked for or half of the physical memory
+off_t memoryBudget()
+{
+  off_t budget = (off_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+  if(cliArgs.memory > 0)
+    budget = (off_t)cliArgs.memory * 1024 * 1024;
+
+  // files being rendered at the same time each get a share
+  if(cliArgs.renderPath != NULL)
+    budget /= max(workers.threads, 1);
+  return budget;
+}
+
 // whether a value is in a range
-int inRange(int value, int a, int b)
+int inRange(int64_t value, int64_t a, int64_t b)
 {
-  int min = min(a, b);
-  int max = max(a, b);
+  int64_t min = min(a, b);
+  int64_t max = max(a, b);
   return min <= value && value < max;
 }
 
+// get the current play position
+int64_t getPlayPosition()
+{
+  return __atomic_load_n(&transport.position, __ATOMIC_ACQUIRE);
+}
+
+// make playback jump to a position
+// the callback picks it up the next time it runs
+void seek(int64_t position)
+{
+  __atomic_store_n(&transport.seekPosition, position, __ATOMIC_RELAXED);
+  __atomic_store_n(&transport.position, position, __ATOMIC_RELEASE);
+  __atomic_store_n(&transport.seekPending, 1, __ATOMIC_RELEASE);
+}
+
+// whether audio is currently playing
+// the audio callback can stop playback by itself
+int isPlaying()
+{
+  return __atomic_load_n(&playing, __ATOMIC_ACQUIRE);
+}
+
+// get the current selection
+// the audio callback reads it while the interface changes it
+struct region getSelection()
+{
+  struct region region = { __atomic_load_n(&selection.start, __ATOMIC_ACQUIRE),
+			   __atomic_load_n(&selection.stop, __ATOMIC_ACQUIRE) };
+  return region;
+}
+
 // whether a sample position is inside the user selection
-int inSelection(int position)
+int inSelection(int64_t position)
 {
   return inRange(position, selection.start, selection.stop);
 }
@@ -224,739 +1009,5529 @@ int selectionExists()
   return selection.start != selection.stop;
 }
 
-// calculate the sum of the squares in a range of values
-double sumOfSquares(int offset, int length, int16_t* array, int arrayLength)
+// create an empty chunked array
+// with chunks of 2^shift elements and room for up to capacity elements
+struct chunkedArray createChunkedArray(int elementSize, int shift, int64_t capacity)
 {
-  int i;
-  double sum = 0;
-  for(i = offset; i < offset + length; i++)
-    {
-      double value = ((i < 0) || (i >= arrayLength)) ? 0 : array[i];
-      sum += value * value;
-    }
-  return sum;
+  struct chunkedArray array;
+  array.elementSize = elementSize;
+  array.shift = shift;
+  array.chunkCount = ((capacity - 1) >> shift) + 1;
+  array.index = (char***)calloc(((array.chunkCount - 1) >> INDEX_PAGE_SHIFT) + 1, sizeof(char**));
+  array.mapping = NULL;
+  array.mappingSize = 0;
+  array.fd = -1;
+  array.fileOffset = 0;
+  return array;
 }
 
-// calculate the root mean square of a range of values in an array
-double rootMeanSquare(int offset, int length, int16_t* array, int arrayLength)
+// get a chunk of a chunked array
+// NULL if it hasnt been allocated yet
+char* chunkAt(struct chunkedArray array, int64_t chunk)
 {
-  return sqrt(sumOfSquares(offset, length, array, arrayLength) / length);
+  char** page = array.index[chunk >> INDEX_PAGE_SHIFT];
+  return page == NULL ? NULL : page[chunk & ((1 << INDEX_PAGE_SHIFT) - 1)];
 }
 
-// draw a waveform on an sdl surface given a viewport
-void drawWaveform(SDL_Surface* surface, struct audioBuffer buffer, struct region viewport)
+// get the place in the index a chunk goes, allocating the page its on if needed
+// returns NULL if the page couldnt be allocated
+char** chunkSlot(struct chunkedArray* array, int64_t chunk)
 {
-  // get dimensions for conveniences
-  int width = surface->w;
-  int height = surface->h;
+  char*** page = &array->index[chunk >> INDEX_PAGE_SHIFT];
+  if(*page == NULL)
+    *page = (char**)calloc(1 << INDEX_PAGE_SHIFT, sizeof(char*));
+  return *page == NULL ? NULL : *page + (chunk & ((1 << INDEX_PAGE_SHIFT) - 1));
+}
 
-  // viewport stuff
-  int viewportStartSample = viewport.start;
-  int viewportEndSample = viewport.stop;
-  int sampleRange = viewportEndSample - viewportStartSample;
-  float samplesPerPixel = 1.0 * sampleRange / width;
-  float minSamplesPerPixel = max(1, samplesPerPixel);
-  int samplePeak = INT16_MAX;
+// point the chunks of a chunked array into an already mapped file
+// the array takes over the mapping and unmaps it when its freed
+// returns non-zero if that many elements dont fit, leaving the mapping to the caller
+int adoptMapping(struct chunkedArray* array, char* mapping, size_t mappingSize, off_t offset, int64_t length)
+{
+  if(length <= 0 || ((length - 1) >> array->shift) >= array->chunkCount) return -1;
 
-  // draw each column
+  // every chunk is just a slice of the mapping
   int i;
-  for(i = 0; i < width; i++)
+  for(i = 0; i <= (length - 1) >> array->shift; i++)
     {
-      // the sample index at this pixel
-      int sampleIndex = viewportStartSample + i * samplesPerPixel;
+      char** slot = chunkSlot(array, i);
+      if(slot == NULL) return -1;
+      *slot = mapping + offset + ((size_t)i * array->elementSize << array->shift);
+    }
+  array->mapping = mapping;
+  array->mappingSize = mappingSize;
+  return 0;
+}
 
-      // draw audio cursor here if play position is here
-      if(inRange(playPosition, sampleIndex, sampleIndex + minSamplesPerPixel))
-	{
-	  // get rect of this column
-	  SDL_Rect rect = { i, 0, 1, height };
+// point the chunks of a chunked array into a file instead of allocating them
+// the elements start at offset and run to the end of the file
+// returns the number of elements in the file or -1 if it couldnt be mapped
+int64_t mapChunkedArray(struct chunkedArray* array, int fd, off_t offset)
+{
+  struct stat info;
+  if(fstat(fd, &info) || info.st_size <= offset) return -1;
+  int64_t length = min((info.st_size - offset) / array->elementSize, MAX_LENGTH);
+  if(length == 0) return -1;
+  if(((length - 1) >> array->shift) >= array->chunkCount) return -1;
 
-	  // get the fill color
-	  Uint32 color = SDL_MapRGB(surface->format, 255, 255, 255);
+  char* mapping = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(mapping == MAP_FAILED) return -1;
+  if(adoptMapping(array, mapping, info.st_size, offset, length))
+    {
+      munmap(mapping, info.st_size);
+      return -1;
+    }
+  return length;
+}
 
-	  // fill this column
-	  SDL_FillRect(surface, &rect, color);
+// allocate the chunks needed to grow a chunked array from one length to another
+// returns non-zero if it cant grow that big
+int growChunkedArray(struct chunkedArray* array, int64_t oldLength, int64_t newLength)
+{
+  int64_t first = oldLength == 0 ? 0 : ((oldLength - 1) >> array->shift) + 1;
+  int64_t last = (newLength - 1) >> array->shift;
+  if(last >= array->chunkCount) return -1;
+  size_t chunkSize = (size_t)array->elementSize << array->shift;
+  int i;
+  for(i = first; i <= last; i++)
+    {
+      char** slot = chunkSlot(array, i);
+      if(slot == NULL) return -1;
+      if(*slot != NULL) continue;
+      if(array->fd >= 0)
+	{
+	  // the space is reserved first so a full disk fails here instead of on a write to the mapping
+	  off_t offset = array->fileOffset + (off_t)i * chunkSize;
+	  char* chunk = posix_fallocate(array->fd, offset, chunkSize) != 0 ? (char*)MAP_FAILED :
+	    (char*)mmap(NULL, chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED, array->fd, offset);
+	  if(chunk == MAP_FAILED) return -1;
+	  *slot = chunk;
 	}
       else
 	{
-	  // this is the sample percentage and pixel conversions
-	  float samplePercent = rootMeanSquare(sampleIndex, minSamplesPerPixel, buffer.buffer, buffer.length) / samplePeak;
-	  int filledHeight = height * samplePercent;
-	  int unfilledHeight = height - filledHeight;
-      
-	  // get rects of this column
-	  SDL_Rect filledRect = { i, unfilledHeight / 2, 1, filledHeight };
-	  SDL_Rect unfilledRect = { i, 0, 1, unfilledHeight / 2 };
-	  SDL_Rect unfilledRect2 = { i, filledHeight + unfilledHeight / 2, 1, height - (filledHeight + unfilledHeight / 2) };
-
-	  // get the fill colors
-	  Uint32 filledColor;
-	  Uint32 unfilledColor;
-	  // the appropriate waveform color depends on whether its in the user selected region or not
-	  if(inSelection(sampleIndex))
-	    {
-	      filledColor = SDL_MapRGB(surface->format, 255, 255, 0);
-	      unfilledColor = SDL_MapRGB(surface->format, 63, 63, 0);
-	    }
-	  else
-	    {
-	      filledColor = SDL_MapRGB(surface->format, 255, 0, 0);
-	      unfilledColor = SDL_MapRGB(surface->format, 0, 0, 0);
-	    }
-
-	  // fill this column
-	  SDL_FillRect(surface, &filledRect, filledColor);
-	  SDL_FillRect(surface, &unfilledRect, unfilledColor);
-	  SDL_FillRect(surface, &unfilledRect2, unfilledColor);
+	  *slot = (char*)malloc(chunkSize);
+	  if(*slot == NULL) return -1;
 	}
     }
+  return 0;
 }
 
-// update the window title to show status
-void updateWindowTitle()
+// have the chunks of an empty chunked array mapped from a file as they're needed
+// so the kernel can page them in and out instead of them taking up memory
+// the offset and the size of a chunk have to be multiples of the page size
+void pageChunkedArray(struct chunkedArray* array, int fd, off_t offset)
 {
-  char title[32];
-  sprintf(title, "Wavy: [%s] [%s]",
-	  playing ? "P" : "-",
-	  looping ? "L" : "-");
-  SDL_SetWindowTitle(mainWindow, title);
+  array->fd = fd;
+  array->fileOffset = offset;
 }
 
-// used to draw the screen when something changes
-// todo: only update within a damaged rect ?
-void redrawScreen()
+// whether the elements of a chunked array are in a file rather than memory
+int chunkedArrayPaged(struct chunkedArray array)
 {
-  // this is all just temp stuff
-  drawWaveform(mainSurface, audioBuffer, viewport);
-  SDL_UpdateWindowSurface(mainWindow);
+  return array.fd >= 0 || array.mapping != NULL;
 }
 
-// play if paused, pause if playing
-void togglePlaying()
+// tell the kernel what is about to happen to a chunk of a file backed array
+// the advice has to cover whole pages, which for mapped files might spill into a neighbouring chunk
+void adviseChunk(struct chunkedArray array, int64_t chunk, int advice)
 {
-  playing = !playing;
-  updateWindowTitle();
-  // unpause if playing
-  if(playing) SDL_PauseAudioDevice(audioDevice, 0);
+  size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)chunkAt(array, chunk);
+  uintptr_t stop = start + ((size_t)array.elementSize << array.shift);
+  start -= start % page;
+  stop += (page - stop % page) % page;
+  madvise((void*)start, stop - start, advice);
 }
 
-// toggle whether audio should loop
-void toggleLooping()
+// free all the chunks of a chunked array
+void freeChunkedArray(struct chunkedArray* array)
 {
-  looping = !looping;
-  updateWindowTitle();
+  int i;
+  if(array->mapping != NULL)
+    munmap(array->mapping, array->mappingSize);
+  else if(array->fd >= 0)
+    {
+      for(i = 0; i < array->chunkCount && chunkAt(*array, i) != NULL; i++)
+	munmap(chunkAt(*array, i), (size_t)array->elementSize << array->shift);
+      close(array->fd);
+      array->fd = -1;
+    }
+  else
+    // chunks are only ever allocated in order from the start
+    // so the rest of the index doesnt have to be looked at
+    for(i = 0; i < array->chunkCount && chunkAt(*array, i) != NULL; i++)
+      free(chunkAt(*array, i));
+  for(i = 0; i <= (array->chunkCount - 1) >> INDEX_PAGE_SHIFT; i++)
+    free(array->index[i]);
+  free(array->index);
+  array->index = NULL;
+  array->mapping = NULL;
 }
 
-// sdl audio fetch callback for more audio
-void requestAudio(void* userdata, Uint8* stream, int remainingBytes)
+// get a pointer to an element of a chunked array
+void* chunkedElement(struct chunkedArray array, int64_t index)
 {
-  if(playing)
-    {
-      // if playing, fill the provided buffer with audio to play
-      // copy regions of audio until the end of file or region
-      // then either stop or loop depending on looping status
-      int offset = 0;
-      while(remainingBytes > 0)
-	{
-	  int remainingSamples = remainingBytes / sizeof(int16_t);
-	  // get the nearest stopping point
-	  int end, start;
-	  if(selectionExists())
-	    {
-	      end = max(selection.start,
-			selection.stop);
-	      start = min(selection.start,
-			  selection.stop);
-	    }
-	  else
-	    {
-	      end = audioBuffer.length;
-	      start = 0;
-	    }
-	  // make sure the play position isnt greater than the end
-	  // or less than start
-	  if(playPosition > end) playPosition = end;
-	  if(playPosition < start ||
-	     playPosition == end)
-	    playPosition = start;
-	  int distance = end - playPosition;
+  int mask = (1 << array.shift) - 1;
+  return array.index[index >> (array.shift + INDEX_PAGE_SHIFT)][(index >> array.shift) & ((1 << INDEX_PAGE_SHIFT) - 1)] +
+    (size_t)(index & mask) * array.elementSize;
+}
 
-	  // only copy to the nearest stopping point
-	  int len;
-	  if(distance < remainingSamples)
-	    len = distance;
-	  else
-	    len = remainingSamples;
-	  int lenBytes = len * sizeof(int16_t);
+// how many elements follow an element in the same chunk, including itself
+// this is how far a pointer from chunkedElement can be walked
+int chunkRemaining(struct chunkedArray array, int64_t index)
+{
+  int mask = (1 << array.shift) - 1;
+  return (mask + 1) - (index & mask);
+}
 
-	  // copy this portion
-	  memcpy(stream + offset,
-		 audioBuffer.buffer + playPosition,
-		 lenBytes);
-	  playPosition += len;
-	  offset += lenBytes;
-	  remainingBytes -= lenBytes;
+// get a pointer to a frame of an audio buffer
+// the samples of each channel follow one after another
+int16_t* sampleAt(struct audioBuffer buffer, int64_t index)
+{
+  return (int16_t*)chunkedElement(buffer.samples, index);
+}
 
-	  // if theres some left over, see if loop is on
-	  if(remainingBytes > 0)
-	    {
-	      if(looping)
-		{
-		  // loop back to begining of selection
-		  playPosition = start;
-		}
-	      else
-		{
-		  // looks like loop is off
-		  // meaning playback has got to end here. >:(
-		  togglePlaying();
-		  // be sure to update the screen
-		  // (not reduntant, below is only when playing)
-		  // but this is a temp workaround
-		  // to /help/ prevent crashing when playing
-		  // while resizing the window at the same time
-		  redrawScreen();
-		  // and fill the rest with silecnc while ur at it
-		  memset(stream + offset, 0, remainingBytes);
-		  break; // <- very very important!! ><
-		}
-	    }
-	}
-      
-      // redraw the screen for the playhead
-      if(!ASYNC_PLAY_ANIMATION && playing) redrawScreen();
-    }
-  else
+// copy a range of frames out of an audio buffer
+void copySamples(struct audioBuffer buffer, int64_t start, int length, int16_t* destination)
+{
+  while(length > 0)
     {
-      // if not playing, got to give sdl some silence
-      //memset(stream, 0, remaining);
-      // also as a bonus pause audio device if not playing
-      SDL_PauseAudioDevice(audioDevice, !playing);
+      int span = min(length, chunkRemaining(buffer.samples, start));
+      memcpy(destination, sampleAt(buffer, start), (size_t)span * buffer.samples.elementSize);
+      destination += span * buffer.channels;
+      start += span;
+      length -= span;
     }
 }
 
-// see which modifiers are currently held down
-struct modifiers getModifiers()
+// get a run of one channel's samples as a plain array for the kernels
+// mono audio is like that already, otherwise they get picked out into the scratch space
+// the run has to be inside one chunk and fit in the scratch space
+const int16_t* channelRun(struct audioBuffer buffer, int channel, int64_t start, int length, int16_t* scratch)
 {
-  const Uint8* state = SDL_GetKeyboardState(NULL);
-  struct modifiers modifiers = { state[SDL_SCANCODE_LCTRL] ||
-				 state[SDL_SCANCODE_RCTRL],
-				 state[SDL_SCANCODE_LALT] ||
-				 state[SDL_SCANCODE_RALT],
-				 state[SDL_SCANCODE_LSHIFT] ||
-				 state[SDL_SCANCODE_LSHIFT]};
-  return modifiers;
+  const int16_t* frames = sampleAt(buffer, start);
+  if(buffer.channels == 1) return frames;
+  int i;
+  for(i = 0; i < length; i++)
+    scratch[i] = frames[i * buffer.channels + channel];
+  return scratch;
 }
 
-// get the final target of an abstract user event
-enum target getFinalTarget(enum target target)
+// get how many samples of a buffer have been loaded so far
+// safe to use while the loader is still filling it in
+int64_t loadedLength(struct audioBuffer* buffer)
 {
-  // let the target be overridable by modifiers
-  struct modifiers modifiers = getModifiers();
-  if(modifiers.ctrl && modifiers.alt)
-    return PLAY;
-  else if(modifiers.ctrl && !modifiers.alt)
-    return REGION;
-  else if(!modifiers.ctrl && modifiers.alt)
-    return VIEWPORT;
-  // other wise it stays unchanged
-  else return target;
+  return __atomic_load_n(&buffer->length, __ATOMIC_ACQUIRE);
 }
 
-// get the values of an abstract user input target
-struct targetValues getTargetValues(enum target target)
+// get the part of the global audio buffer thats been loaded so far
+struct audioBuffer loadedAudio()
 {
-  // the return values will go in here
-  struct targetValues values = { 0, 0 };
+  struct audioBuffer buffer = audioBuffer;
+  buffer.length = loadedLength(&audioBuffer);
+  return buffer;
+}
 
-  // get the values for the given input target
-  switch(target)
-    {
-    case PLAY:
-      // get the audio cursor position
-      values.primary = playPosition;
-      values.secondary = playPosition;
-      break;
-    case REGION:
-      // get the selected region of audio
-      values.primary = selection.start;
-      values.secondary = selection.stop;
-      break;
-    case VIEWPORT:
-      // get the viewport region
-      values.primary = viewport.start;
-      values.secondary = viewport.stop;
-      break;
-    }
-  
-  // return the values
-  return values;
+// take another reference to the samples of an audio buffer
+// so they stay around for as long as the copy of the struct is needed
+struct audioBuffer retainAudio(struct audioBuffer buffer)
+{
+  __atomic_add_fetch(buffer.references, 1, __ATOMIC_RELAXED);
+  return buffer;
 }
 
-// get either primary or secondary value of target
-int getTargetValue(enum target target, enum action which)
+// drop a reference to the samples of an audio buffer
+// freeing them when it was the last one
+void releaseAudio(struct audioBuffer buffer)
 {
-  // get whichever one it is
-  switch(which)
-    {
-    case PRIMARY:
-      return getTargetValues(target).primary;
-    case SECONDARY:
-      return getTargetValues(target).secondary;
-    }
+  if(__atomic_sub_fetch(buffer.references, 1, __ATOMIC_ACQ_REL) > 0) return;
+  freeChunkedArray(&buffer.samples);
+  if(buffer.squareSums.index != NULL) freeChunkedArray(&buffer.squareSums);
+  free(buffer.references);
 }
 
-// set the values of an abstract user input target
-void setTargetValues(enum target target, struct targetValues values)
+// whether the loader has read the whole file yet
+int loadingDone()
 {
-  switch(target)
-    {
-    case PLAY:
-      // set the audio cursor position
-      playPosition = values.primary;
-      break;
-    case REGION:
-      // set the selected region of audio
-      selection.start = values.primary;
-      selection.stop = values.secondary;
-      break;
-    case VIEWPORT:
-      // set the viewport region
-      viewport.start = values.primary;
-      viewport.stop = values.secondary;
-      break;
-    }
-  
-  // show the changes on the screen
-  redrawScreen();
+  return __atomic_load_n(&loader.done, __ATOMIC_ACQUIRE);
 }
 
-// set specifically the primary value of a target
-void setTargetPrimaryValue(enum target target, int value)
+// the length the audio is expected to end up with
+// only certain once loading is done
+int64_t expectedLength()
 {
-  struct targetValues old = getTargetValues(target);
-  struct targetValues new = { value, old.secondary };
-  setTargetValues(target, new);
+  int64_t length = loadedLength(&audioBuffer);
+  if(loadingDone()) return length;
+  return max(length, loader.expectedLength);
 }
 
-// set specifically the secondary value of a target
-void setTargetSecondaryValue(enum target target, int value)
+// keep a position within the audio there is or is going to be
+// the viewport can go past either end so the mouse can point outside it
+int64_t clampToAudio(int64_t position)
 {
-  struct targetValues old = getTargetValues(target);
-  struct targetValues new = { old.primary, value };
-  setTargetValues(target, new);
+  return max(0, min(position, expectedLength()));
 }
 
-// set both values of a target the same
-void setTargetBothValues(enum target target, int value)
+// plain c kernels that work everywhere
+int scalarSupported()
 {
-  struct targetValues new = { value, value };
-  setTargetValues(target, new);
+  return 1;
 }
 
-// set either primary or secondary value of target
-void setTargetValue(enum target target, int value, enum action which)
+int64_t scalarSumOfSquares(const int16_t* samples, int length)
 {
-  // set whichever one it is
-  switch(which)
+  int64_t sum = 0;
+  int i;
+  for(i = 0; i < length; i++)
+    sum += samples[i] * samples[i];
+  return sum;
+}
+
+void scalarMinMax(const int16_t* samples, int length, int16_t* min, int16_t* max)
+{
+  int i;
+  for(i = 0; i < length; i++)
     {
-    case PRIMARY:
-      setTargetPrimaryValue(target, value);
-      break;
-    case SECONDARY:
-      setTargetSecondaryValue(target, value);
-      break;
+      *min = min(*min, samples[i]);
+      *max = max(*max, samples[i]);
     }
 }
 
-// set both values but separate
-void setTargetPrimaryAndSecondaryValues(enum target target, int primary, int secondary)
+// floats are scaled by 32768, clamped then rounded to the nearest
+// the clamping is written the way the vector min and max treat nans so they all agree
+void scalarConvertFloats(const float* floats, int length, int16_t* samples)
 {
-  struct targetValues new = { primary, secondary };
-  setTargetValues(target, new);
+  int i;
+  for(i = 0; i < length; i++)
+    {
+      float value = floats[i] * 32768.0f;
+      value = value < 32767.0f ? value : 32767.0f;
+      value = value > -32768.0f ? value : -32768.0f;
+      samples[i] = lrintf(value);
+    }
 }
 
-// get the sample index at a pixel position
-int pixelCoordinateToSample(int x)
+// each sample is a pair of samples weighed up by a pair of weights that add up to one
+// the weights have INTERPOLATE_SHIFT fraction bits and the result is rounded
+void scalarInterpolate(const int16_t* pairs, const int16_t* weights, int length, int16_t* samples)
 {
-  // get pixel coordinates
-  int width = mainSurface->w;
-
-  // viewport stuff
-  int viewportStartSample = viewport.start;
-  int viewportEndSample = viewport.stop;
-  int sampleRange = viewportEndSample - viewportStartSample;
-  float samplesPerPixel = 1.0 * sampleRange / width;
-  int sampleIndex = viewportStartSample + x * samplesPerPixel;
+  int i;
+  for(i = 0; i < length; i++)
+    samples[i] = (pairs[i * 2] * weights[i * 2] + pairs[i * 2 + 1] * weights[i * 2 + 1] +
+		  (1 << (INTERPOLATE_SHIFT - 1))) >> INTERPOLATE_SHIFT;
+}
 
-  // return the sample index
-  return sampleIndex;
+// multiply samples by a window on the way to floats for an fft
+void scalarWindow(const int16_t* samples, const float* window, int length, float* windowed)
+{
+  int i;
+  for(i = 0; i < length; i++)
+    windowed[i] = samples[i] * window[i];
 }
 
-// get the pixel position of a sample
-int sampleToPixelCoordinate(int position)
+#ifdef X86_KERNELS
+// fold the lanes of vector minimums and maximums into a single min and max
+void reduceMinMax(const int16_t* lows, const int16_t* highs, int lanes, int16_t* min, int16_t* max)
 {
-  // get pixel coordinates
-  int width = mainSurface->w;
+  int i;
+  for(i = 0; i < lanes; i++)
+    {
+      *min = min(*min, lows[i]);
+      *max = max(*max, highs[i]);
+    }
+}
 
-  // viewport stuff
-  int viewportStartSample = viewport.start;
-  int viewportEndSample = viewport.stop;
-  int sampleRange = viewportEndSample - viewportStartSample;
-  float samplesPerPixel = 1.0 * sampleRange / width;
-  int pixelPosition = (position - viewportStartSample) / samplesPerPixel;
+// the squares are summed in pairs with a multiply-add
+// a pair can reach 2^31 so the 32-bit results are treated as unsigned
+// and widened to 64 bits before accumulating
 
-  // return the pixel position
-  return pixelPosition;
+int sse2Supported()
+{
+  return __builtin_cpu_supports("sse2");
 }
 
-// get the sample index at the mouse position
-int getMouseSamplePosition(SDL_Event event)
+__attribute__((target("sse2")))
+int64_t sse2SumOfSquares(const int16_t* samples, int length)
 {
-  return pixelCoordinateToSample(event.motion.x);
+  __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  int i;
+  for(i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+      __m128i pairs = _mm_madd_epi16(values, values);
+      sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(pairs, zero));
+      sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(pairs, zero));
+    }
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, sum);
+  return lanes[0] + lanes[1] + scalarSumOfSquares(samples + i, length - i);
 }
 
-enum action getNearestSelectionPole(int position)
+__attribute__((target("sse2")))
+void sse2MinMax(const int16_t* samples, int length, int16_t* min, int16_t* max)
 {
-  // get the distances between both poles
-  int primaryDelta = abs(selection.start - position);
-  int secondaryDelta = abs(selection.stop - position);
-
-  // return whichever is closest
-  if(primaryDelta < secondaryDelta)
-    return PRIMARY;
-  else return SECONDARY;
+  __m128i low = _mm_set1_epi16(*min);
+  __m128i high = _mm_set1_epi16(*max);
+  int i;
+  for(i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+      low = _mm_min_epi16(low, values);
+      high = _mm_max_epi16(high, values);
+    }
+  int16_t lows[8], highs[8];
+  _mm_storeu_si128((__m128i*)lows, low);
+  _mm_storeu_si128((__m128i*)highs, high);
+  reduceMinMax(lows, highs, 8, min, max);
+  scalarMinMax(samples + i, length - i, min, max);
 }
 
-// initiate a region selection
-void initiateSelection(int position)
+__attribute__((target("sse2")))
+void sse2ConvertFloats(const float* floats, int length, int16_t* samples)
 {
-  // if shift is held then modify existing selection
-  struct modifiers modifiers = getModifiers();
-  if(modifiers.shift)
+  __m128 scale = _mm_set1_ps(32768.0f);
+  __m128 high = _mm_set1_ps(32767.0f);
+  __m128 low = _mm_set1_ps(-32768.0f);
+  int i;
+  for(i = 0; i + 8 <= length; i += 8)
     {
-      // grab the nearest pole
-      selectionGrabbedPole = getNearestSelectionPole(position);
-
-      // get the pixel position of that pole
-      int pole = getTargetValue(REGION, selectionGrabbedPole);
-      int pixelPosition = sampleToPixelCoordinate(pole);
-
-      // warp the mouse to the pole
-      SDL_WarpMouseInWindow(mainWindow, pixelPosition, mainSurface->h / 2);
+      __m128 first = _mm_mul_ps(_mm_loadu_ps(floats + i), scale);
+      __m128 second = _mm_mul_ps(_mm_loadu_ps(floats + i + 4), scale);
+      first = _mm_max_ps(_mm_min_ps(first, high), low);
+      second = _mm_max_ps(_mm_min_ps(second, high), low);
+      __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(first), _mm_cvtps_epi32(second));
+      _mm_storeu_si128((__m128i*)(samples + i), packed);
     }
-  // otherwise grab the nearest pole
-  else
-    {
-      // clear the selection
-      setTargetBothValues(REGION, position);
+  scalarConvertFloats(floats + i, length - i, samples + i);
+}
 
-      // grab the secondary pole
-      selectionGrabbedPole = SECONDARY;
+// a multiply-add does both halves of each pair at once
+__attribute__((target("sse2")))
+void sse2Interpolate(const int16_t* pairs, const int16_t* weights, int length, int16_t* samples)
+{
+  __m128i round = _mm_set1_epi32(1 << (INTERPOLATE_SHIFT - 1));
+  int i;
+  for(i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i first = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(pairs + i * 2)),
+				     _mm_loadu_si128((const __m128i*)(weights + i * 2)));
+      __m128i second = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(pairs + i * 2 + 8)),
+				      _mm_loadu_si128((const __m128i*)(weights + i * 2 + 8)));
+      first = _mm_srai_epi32(_mm_add_epi32(first, round), INTERPOLATE_SHIFT);
+      second = _mm_srai_epi32(_mm_add_epi32(second, round), INTERPOLATE_SHIFT);
+      _mm_storeu_si128((__m128i*)(samples + i), _mm_packs_epi32(first, second));
     }
+  scalarInterpolate(pairs + i * 2, weights + i * 2, length - i, samples + i);
 }
 
-// continue a region selection
-void continueSelection(int position)
+// the samples get sign extended by unpacking them with their own sign bits
+__attribute__((target("sse2")))
+void sse2Window(const int16_t* samples, const float* window, int length, float* windowed)
 {
-  // set the position of whichever selection pole is grabbed
-  setTargetValue(REGION, position, selectionGrabbedPole);
+  int i;
+  for(i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i values = _mm_loadu_si128((const __m128i*)(samples + i));
+      __m128i signs = _mm_srai_epi16(values, 15);
+      __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, signs));
+      __m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, signs));
+      _mm_storeu_ps(windowed + i, _mm_mul_ps(low, _mm_loadu_ps(window + i)));
+      _mm_storeu_ps(windowed + i + 4, _mm_mul_ps(high, _mm_loadu_ps(window + i + 4)));
+    }
+  scalarWindow(samples + i, window + i, length - i, windowed + i);
 }
 
-// unselect anything
-void cancelSelection()
+int avx2Supported()
 {
-  setTargetBothValues(REGION, 0);
+  return __builtin_cpu_supports("avx2");
 }
 
-// general zoom the viewport
-void zoom(int origin, double amount)
+__attribute__((target("avx2")))
+int64_t avx2SumOfSquares(const int16_t* samples, int length)
 {
-  // calculate scale factor from zoom amount
-  double scale = pow(2, amount);
-
-  // get the distance the origin is from both ends of the viewport
-  int startDelta = viewport.start - origin;
-  int stopDelta = viewport.stop - origin;
-
-  // scale those distances
-  startDelta /= scale;
-  stopDelta /= scale;
-
-  // set the new viewport
-  setTargetPrimaryAndSecondaryValues(VIEWPORT,
-				     origin + startDelta,
-				     origin + stopDelta);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sum = zero;
+  int i;
+  for(i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i values = _mm256_loadu_si256((const __m256i*)(samples + i));
+      __m256i pairs = _mm256_madd_epi16(values, values);
+      sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(pairs, zero));
+      sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(pairs, zero));
+    }
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+    scalarSumOfSquares(samples + i, length - i);
 }
 
-// general pan the viewport
-void pan(int delta)
+__attribute__((target("avx2")))
+void avx2MinMax(const int16_t* samples, int length, int16_t* min, int16_t* max)
 {
-  // get pixel coordinates
-  int width = mainSurface->w;
-
-  // viewport stuff
-  int viewportStartSample = viewport.start;
-  int viewportEndSample = viewport.stop;
-  int sampleRange = viewportEndSample - viewportStartSample;
-  float samplesPerPixel = 1.0 * sampleRange / width;
-  int deltaSamples = delta * samplesPerPixel;
-
-  // set the new viewport
-  setTargetPrimaryAndSecondaryValues(VIEWPORT,
-				     viewport.start - deltaSamples,
-				     viewport.stop - deltaSamples);
+  __m256i low = _mm256_set1_epi16(*min);
+  __m256i high = _mm256_set1_epi16(*max);
+  int i;
+  for(i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i values = _mm256_loadu_si256((const __m256i*)(samples + i));
+      low = _mm256_min_epi16(low, values);
+      high = _mm256_max_epi16(high, values);
+    }
+  int16_t lows[16], highs[16];
+  _mm256_storeu_si256((__m256i*)lows, low);
+  _mm256_storeu_si256((__m256i*)highs, high);
+  reduceMinMax(lows, highs, 16, min, max);
+  scalarMinMax(samples + i, length - i, min, max);
 }
 
-// pan the viewport with mouse drag
-void dragViewport(SDL_Event event)
+// the pack works within each half so the quarters need putting back in order after
+__attribute__((target("avx2")))
+void avx2ConvertFloats(const float* floats, int length, int16_t* samples)
 {
-  pan(event.motion.xrel);
+  __m256 scale = _mm256_set1_ps(32768.0f);
+  __m256 high = _mm256_set1_ps(32767.0f);
+  __m256 low = _mm256_set1_ps(-32768.0f);
+  int i;
+  for(i = 0; i + 16 <= length; i += 16)
+    {
+      __m256 first = _mm256_mul_ps(_mm256_loadu_ps(floats + i), scale);
+      __m256 second = _mm256_mul_ps(_mm256_loadu_ps(floats + i + 8), scale);
+      first = _mm256_max_ps(_mm256_min_ps(first, high), low);
+      second = _mm256_max_ps(_mm256_min_ps(second, high), low);
+      __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(first), _mm256_cvtps_epi32(second));
+      _mm256_storeu_si256((__m256i*)(samples + i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+  scalarConvertFloats(floats + i, length - i, samples + i);
 }
 
-// deal with mouse drags
-void mouseDrag(SDL_Event event, enum target target)
+__attribute__((target("avx2")))
+void avx2Interpolate(const int16_t* pairs, const int16_t* weights, int length, int16_t* samples)
 {
-  // override with modifiers
-  target = getFinalTarget(target);
-
-  // do different things depending on the target
-  switch(target)
+  __m256i round = _mm256_set1_epi32(1 << (INTERPOLATE_SHIFT - 1));
+  int i;
+  for(i = 0; i + 16 <= length; i += 16)
     {
-    case PLAY:
-      // set the player position
-      setTargetPrimaryValue(target, getMouseSamplePosition(event));
-      break;
-    case REGION:
-      // continue a selection
-      continueSelection(getMouseSamplePosition(event));
-      break;
-    case VIEWPORT:
-      dragViewport(event);
-      break;
+      __m256i first = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(pairs + i * 2)),
+					_mm256_loadu_si256((const __m256i*)(weights + i * 2)));
+      __m256i second = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i*)(pairs + i * 2 + 16)),
+					 _mm256_loadu_si256((const __m256i*)(weights + i * 2 + 16)));
+      first = _mm256_srai_epi32(_mm256_add_epi32(first, round), INTERPOLATE_SHIFT);
+      second = _mm256_srai_epi32(_mm256_add_epi32(second, round), INTERPOLATE_SHIFT);
+      __m256i packed = _mm256_packs_epi32(first, second);
+      _mm256_storeu_si256((__m256i*)(samples + i), _mm256_permute4x64_epi64(packed, 0xd8));
     }
+  scalarInterpolate(pairs + i * 2, weights + i * 2, length - i, samples + i);
 }
 
-// handle window events
-int handleWindowEvent(SDL_Event event)
+__attribute__((target("avx2")))
+void avx2Window(const int16_t* samples, const float* window, int length, float* windowed)
 {
-  switch(event.window.event)
+  int i;
+  for(i = 0; i + 16 <= length; i += 16)
     {
-    case SDL_WINDOWEVENT_SIZE_CHANGED:
-      // temporary to (help) prevent crashing while playing...
-      // still doesnt solve it tho
-      if(playing) togglePlaying();
-      // anyway, get the new surface
-      mainSurface = SDL_GetWindowSurface(mainWindow);
-      break;
-    case SDL_WINDOWEVENT_EXPOSED:
-      redrawScreen();
-      break;
+      __m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i))));
+      __m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(samples + i + 8))));
+      _mm256_storeu_ps(windowed + i, _mm256_mul_ps(low, _mm256_loadu_ps(window + i)));
+      _mm256_storeu_ps(windowed + i + 8, _mm256_mul_ps(high, _mm256_loadu_ps(window + i + 8)));
+    }
+  scalarWindow(samples + i, window + i, length - i, windowed + i);
+}
+
+int avx512Supported()
+{
+  return __builtin_cpu_supports("avx512bw");
+}
+
+__attribute__((target("avx512f,avx512bw")))
+int64_t avx512SumOfSquares(const int16_t* samples, int length)
+{
+  __m512i zero = _mm512_setzero_si512();
+  __m512i sum = zero;
+  int i;
+  for(i = 0; i + 32 <= length; i += 32)
+    {
+      __m512i values = _mm512_loadu_si512((const void*)(samples + i));
+      __m512i pairs = _mm512_madd_epi16(values, values);
+      sum = _mm512_add_epi64(sum, _mm512_unpacklo_epi32(pairs, zero));
+      sum = _mm512_add_epi64(sum, _mm512_unpackhi_epi32(pairs, zero));
+    }
+  return _mm512_reduce_add_epi64(sum) + scalarSumOfSquares(samples + i, length - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void avx512MinMax(const int16_t* samples, int length, int16_t* min, int16_t* max)
+{
+  __m512i low = _mm512_set1_epi16(*min);
+  __m512i high = _mm512_set1_epi16(*max);
+  int i;
+  for(i = 0; i + 32 <= length; i += 32)
+    {
+      __m512i values = _mm512_loadu_si512((const void*)(samples + i));
+      low = _mm512_min_epi16(low, values);
+      high = _mm512_max_epi16(high, values);
+    }
+  int16_t lows[32], highs[32];
+  _mm512_storeu_si512((void*)lows, low);
+  _mm512_storeu_si512((void*)highs, high);
+  reduceMinMax(lows, highs, 32, min, max);
+  scalarMinMax(samples + i, length - i, min, max);
+}
+#endif
+
+// all the kernel sets from most to least preferred
+struct kernels kernelSets[] =
+  {
+#ifdef X86_KERNELS
+    { "avx512", avx512Supported, avx512SumOfSquares, avx512MinMax, avx2ConvertFloats, avx2Interpolate, avx2Window },
+    { "avx2", avx2Supported, avx2SumOfSquares, avx2MinMax, avx2ConvertFloats, avx2Interpolate, avx2Window },
+    { "sse2", sse2Supported, sse2SumOfSquares, sse2MinMax, sse2ConvertFloats, sse2Interpolate, sse2Window },
+#endif
+    { "scalar", scalarSupported, scalarSumOfSquares, scalarMinMax, scalarConvertFloats, scalarInterpolate, scalarWindow }
+  };
+#define KERNEL_SETS (sizeof(kernelSets) / sizeof(kernelSets[0]))
+
+// pick the sample kernels to use
+// either the ones asked for or the best this cpu supports
+int initKernels()
+{
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+#endif
+  int i;
+  for(i = 0; i < KERNEL_SETS; i++)
+    {
+      if(cliArgs.kernels != NULL && strcmp(cliArgs.kernels, kernelSets[i].name) != 0)
+	continue;
+      if(kernelSets[i].supported())
+	{
+	  kernels = kernelSets[i];
+	  return 0;
+	}
+    }
+  fprintf(stderr, "Sample kernels \"%s\" aren't available!\n", cliArgs.kernels);
+  return -1;
+}
+
+// compare every supported kernel set against the plain c one
+// returns non-zero if any of them disagree
+int checkKernels()
+{
+  int16_t* samples = (int16_t*)malloc(4096 * sizeof(int16_t));
+  float* floats = (float*)malloc(4096 * sizeof(float));
+  int16_t* expected = (int16_t*)malloc(4096 * sizeof(int16_t));
+  int16_t* weights = (int16_t*)malloc(4096 * sizeof(int16_t));
+  int16_t* actual = (int16_t*)malloc(2048 * sizeof(int16_t));
+  float* expectedWindowed = (float*)malloc(4096 * sizeof(float));
+  float* actualWindowed = (float*)malloc(4096 * sizeof(float));
+  int failures = 0;
+  int i, trial;
+  for(i = 0; i < KERNEL_SETS; i++)
+    {
+      struct kernels* set = &kernelSets[i];
+      if(!set->supported())
+	{
+	  printf("%s: not supported\n", set->name);
+	  continue;
+	}
+      int agree = 1;
+      for(trial = 0; trial < 1000; trial++)
+	{
+	  // random lengths and misalignments, with some runs of extreme values
+	  int offset = rand() % 64;
+	  int length = rand() % (4096 - offset);
+	  int j;
+	  for(j = 0; j < 4096; j++)
+	    samples[j] = trial % 4 == 0 ? INT16_MIN : trial % 4 == 1 ? INT16_MAX : rand();
+	  int16_t expectedMin = INT16_MAX, expectedMax = INT16_MIN;
+	  int16_t actualMin = INT16_MAX, actualMax = INT16_MIN;
+	  scalarMinMax(samples + offset, length, &expectedMin, &expectedMax);
+	  set->minMax(samples + offset, length, &actualMin, &actualMax);
+	  if(scalarSumOfSquares(samples + offset, length) != set->sumOfSquares(samples + offset, length) ||
+	     expectedMin != actualMin || expectedMax != actualMax)
+	    agree = 0;
+
+	  // floats a bit past full scale either way, with the odd nan or infinity
+	  for(j = 0; j < 4096; j++)
+	    floats[j] = rand() % 97 == 0 ? (rand() % 2 ? NAN : -INFINITY) : 2.5f * rand() / RAND_MAX - 1.25f;
+	  scalarConvertFloats(floats + offset, length, expected);
+	  set->convertFloats(floats + offset, length, samples);
+	  if(memcmp(expected, samples, length * sizeof(int16_t)) != 0)
+	    agree = 0;
+
+	  // pairs of samples either side of full scale with weights anywhere from one to the other
+	  for(j = 0; j + 1 < 4096; j += 2)
+	    {
+	      samples[j] = trial % 4 == 0 ? INT16_MIN : rand();
+	      samples[j + 1] = trial % 4 == 1 ? INT16_MAX : rand();
+	      weights[j + 1] = rand() % ((1 << INTERPOLATE_SHIFT) + 1);
+	      weights[j] = (1 << INTERPOLATE_SHIFT) - weights[j + 1];
+	    }
+	  int pairs = length / 2, first = offset & ~1;
+	  scalarInterpolate(samples + first, weights + first, pairs, expected);
+	  set->interpolate(samples + first, weights + first, pairs, actual);
+	  if(memcmp(expected, actual, pairs * sizeof(int16_t)) != 0)
+	    agree = 0;
+
+	  // any samples against a window from nothing to one
+	  for(j = 0; j < 4096; j++)
+	    {
+	      samples[j] = trial % 4 == 0 ? INT16_MIN : rand();
+	      floats[j] = 1.0f * rand() / RAND_MAX;
+	    }
+	  scalarWindow(samples + offset, floats + offset, length, expectedWindowed);
+	  set->window(samples + offset, floats + offset, length, actualWindowed);
+	  if(memcmp(expectedWindowed, actualWindowed, length * sizeof(float)) != 0)
+	    agree = 0;
+	}
+      printf("%s: %s\n", set->name, agree ? "ok" : "MISMATCH");
+      failures += !agree;
+    }
+  free(samples);
+  free(floats);
+  free(expected);
+  free(weights);
+  free(actual);
+  free(expectedWindowed);
+  free(actualWindowed);
+  return failures;
+}
+
+// calculate the sum of the squares of one channel in a range of frames
+double sumOfSquares(int64_t offset, int64_t length, struct audioBuffer buffer, int channel)
+{
+  // samples outside of the buffer count as silence
+  int64_t start = max(offset, 0);
+  int64_t stop = min(offset + length, buffer.length);
+
+  // go through it a chunk at a time
+  // or a scratch space at a time if the channel has to be picked out
+  int16_t scratch[SUMMARY_BLOCK_SIZE];
+  int64_t sum = 0;
+  while(start < stop)
+    {
+      int span = min(stop - start, (int64_t)chunkRemaining(buffer.samples, start));
+      if(buffer.channels > 1) span = min(span, SUMMARY_BLOCK_SIZE);
+      sum += kernels.sumOfSquares(channelRun(buffer, channel, start, span, scratch), span);
+      start += span;
+    }
+  return sum;
+}
+
+// calculate the root mean square of one channel in a range of frames
+double rootMeanSquare(int64_t offset, int64_t length, struct audioBuffer buffer, int channel)
+{
+  return sqrt(sumOfSquares(offset, length, buffer, channel) / length);
+}
+
+// get a pointer to one of the prefix sums of squares of an audio buffer
+int64_t* squareSumAt(struct audioBuffer buffer, int64_t index, int channel)
+{
+  return (int64_t*)chunkedElement(buffer.squareSums, index) + channel;
+}
+
+// extend the prefix sums of squares to cover newly loaded frames
+int extendSquareSums(struct audioBuffer* buffer, int64_t newLength)
+{
+  // there's one more sum than there are frames
+  if(growChunkedArray(&buffer->squareSums, buffer->length + 1, newLength + 1))
+    return -1;
+  int64_t i;
+  int c;
+  for(i = buffer->length; i < newLength; i++)
+    for(c = 0; c < buffer->channels; c++)
+      {
+	int64_t value = sampleAt(*buffer, i)[c];
+	*squareSumAt(*buffer, i + 1, c) = *squareSumAt(*buffer, i, c) + value * value;
+      }
+  return 0;
+}
+
+// calculate the sum of the squares of one channel in a range of frames using the prefix sums
+// its just the difference of the running sums at both ends
+double prefixSumOfSquares(int64_t offset, int64_t length, struct audioBuffer buffer, int channel)
+{
+  // samples outside of the buffer count as silence
+  int64_t start = min(max(offset, 0), buffer.length);
+  int64_t stop = min(max(offset + length, 0), buffer.length);
+  return *squareSumAt(buffer, stop, channel) - *squareSumAt(buffer, start, channel);
+}
+
+// summarize a single block of samples
+struct summaryBlock summarizeBlock(const int16_t* samples, int length)
+{
+  struct summaryBlock block = { kernels.sumOfSquares(samples, length), INT16_MAX, INT16_MIN };
+  kernels.minMax(samples, length, &block.min, &block.max);
+  return block;
+}
+
+// get a pointer to the summary of one channel of a block of a summary level
+struct summaryBlock* summaryBlockAt(struct summaryLevel* level, int64_t index, int channel)
+{
+  return (struct summaryBlock*)chunkedElement(level->blocks, index) + channel;
+}
+
+// combine two neighbouring summary blocks into one
+struct summaryBlock mergeBlocks(struct summaryBlock a, struct summaryBlock b)
+{
+  struct summaryBlock block = { a.sumOfSquares + b.sumOfSquares,
+				min(a.min, b.min),
+				max(a.max, b.max) };
+  return block;
+}
+
+// create an empty summary pyramid with room for a given number of frames
+struct summary createSummary(int64_t capacity, int channels)
+{
+  struct summary summary = { 0, channels, NULL };
+
+  // count the levels until a level would only have a single block
+  int64_t blocks = capacity / SUMMARY_BLOCK_SIZE;
+  while(blocks > 0)
+    {
+      summary.levels++;
+      blocks /= 2;
+    }
+  if(summary.levels == 0) return summary;
+  summary.level = (struct summaryLevel*)calloc(summary.levels, sizeof(struct summaryLevel));
+
+  // each level has blocks twice the size of the level below
+  int l;
+  for(l = 0; l < summary.levels; l++)
+    {
+      struct summaryLevel* level = &summary.level[l];
+      level->blockSize = (int64_t)SUMMARY_BLOCK_SIZE << l;
+      level->length = 0;
+      level->blocks = createChunkedArray(sizeof(struct summaryBlock) * channels, SUMMARY_CHUNK_SHIFT, capacity / level->blockSize);
+    }
+
+  return summary;
+}
+
+// free all the levels of a summary pyramid
+void freeSummary(struct summary* summary)
+{
+  int l;
+  for(l = 0; l < summary->levels; l++)
+    freeChunkedArray(&summary->level[l].blocks);
+  free(summary->level);
+  summary->levels = 0;
+  summary->level = NULL;
+}
+
+// extend a summary pyramid to cover newly loaded samples
+// each level only holds complete blocks, the tails are left to the lower levels
+// the block counts are published after the blocks so the summary can be read while this runs
+int extendSummary(struct summary* summary, struct audioBuffer buffer, int64_t newLength)
+{
+  if(summary->levels == 0) return 0;
+
+  // the first level comes straight from the samples
+  // blocks never straddle sample chunks since both are powers of two
+  struct summaryLevel* level = &summary->level[0];
+  int64_t length = newLength / SUMMARY_BLOCK_SIZE;
+  if(growChunkedArray(&level->blocks, level->length, length)) return -1;
+  int16_t scratch[SUMMARY_BLOCK_SIZE];
+  int64_t i;
+  int c;
+  for(i = level->length; i < length; i++)
+    for(c = 0; c < summary->channels; c++)
+      *summaryBlockAt(level, i, c) = summarizeBlock(channelRun(buffer, c, i * SUMMARY_BLOCK_SIZE, SUMMARY_BLOCK_SIZE, scratch),
+						    SUMMARY_BLOCK_SIZE);
+  __atomic_store_n(&level->length, length, __ATOMIC_RELEASE);
+
+  // and every other level from pairs of blocks of the level below
+  int l;
+  for(l = 1; l < summary->levels; l++)
+    {
+      struct summaryLevel* below = &summary->level[l - 1];
+      level = &summary->level[l];
+      length = below->length / 2;
+      if(growChunkedArray(&level->blocks, level->length, length)) return -1;
+      for(i = level->length; i < length; i++)
+	for(c = 0; c < summary->channels; c++)
+	  *summaryBlockAt(level, i, c) = mergeBlocks(*summaryBlockAt(below, i * 2, c),
+						      *summaryBlockAt(below, i * 2 + 1, c));
+      __atomic_store_n(&level->length, length, __ATOMIC_RELEASE);
+    }
+  return 0;
+}
+
+// calculate the sum of the squares of one channel in a range of frames using a summary
+// the range is covered by the biggest summary blocks that fit inside it
+// and only the ragged ends are added up sample by sample
+double summarySumOfSquares(struct summary summary, struct audioBuffer buffer, int channel, int64_t start, int64_t stop)
+{
+  // nothing outside of the buffer
+  start = max(start, 0);
+  stop = min(stop, buffer.length);
+
+  double sum = 0;
+  int64_t position = start;
+  while(position < stop)
+    {
+      // find the biggest block that starts here and fits
+      int level = -1;
+      while(level + 1 < summary.levels)
+	{
+	  struct summaryLevel* next = &summary.level[level + 1];
+	  if(position % next->blockSize != 0 ||
+	     position + next->blockSize > stop ||
+	     position / next->blockSize >= __atomic_load_n(&next->length, __ATOMIC_ACQUIRE))
+	    break;
+	  level++;
+	}
+
+      if(level < 0)
+	{
+	  // no block fits so go sample by sample up to the next block boundary
+	  int64_t next = min(stop, (position / SUMMARY_BLOCK_SIZE + 1) * SUMMARY_BLOCK_SIZE);
+	  sum += sumOfSquares(position, next - position, buffer, channel);
+	  position = next;
+	}
+      else
+	{
+	  // take the whole block at once
+	  struct summaryLevel* summaryLevel = &summary.level[level];
+	  sum += summaryBlockAt(summaryLevel, position / summaryLevel->blockSize, channel)->sumOfSquares;
+	  position += summaryLevel->blockSize;
+	}
+    }
+  return sum;
+}
+
+// calculate the root mean square of one channel in a range of frames using a summary
+double summaryRootMeanSquare(struct summary summary, struct audioBuffer buffer, int channel, int64_t offset, int64_t length)
+{
+  return sqrt(summarySumOfSquares(summary, buffer, channel, offset, offset + length) / length);
+}
+
+// calculate the root mean square of one channel in a column of the waveform
+// using whichever method was chosen
+double columnRootMeanSquare(struct audioBuffer buffer, struct summary summary, int channel, int64_t offset, int64_t length)
+{
+  switch(cliArgs.rmsMode)
+    {
+    case RMS_SUMMARY:
+      return summaryRootMeanSquare(summary, buffer, channel, offset, length);
+    case RMS_PREFIX:
+      return sqrt(prefixSumOfSquares(offset, length, buffer, channel) / length);
+    default:
+      return rootMeanSquare(offset, length, buffer, channel);
+    }
+}
+
+// get the waveform colors mapped to a surface format
+// they only get mapped again when the format changes
+struct palette getPalette(SDL_PixelFormat* format)
+{
+  if(palette.format != format->format)
+    {
+      palette.format = format->format;
+      palette.filled = SDL_MapRGB(format, 255, 0, 0);
+      palette.unfilled = SDL_MapRGB(format, 0, 0, 0);
+      palette.selectedFilled = SDL_MapRGB(format, 255, 255, 0);
+      palette.selectedUnfilled = SDL_MapRGB(format, 63, 63, 0);
+      palette.playhead = SDL_MapRGB(format, 255, 255, 255);
+    }
+  return palette;
+}
+
+// write one pixel of any size
+void writePixel(Uint8* pixel, int bytesPerPixel, Uint32 color)
+{
+  switch(bytesPerPixel)
+    {
+    case 1:
+      *pixel = color;
+      break;
+    case 2:
+      *(Uint16*)pixel = color;
+      break;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+      pixel[0] = color;
+      pixel[1] = color >> 8;
+      pixel[2] = color >> 16;
+#else
+      pixel[0] = color >> 16;
+      pixel[1] = color >> 8;
+      pixel[2] = color;
+#endif
+      break;
+    case 4:
+      *(Uint32*)pixel = color;
+      break;
+    }
+}
+
+// fill a batch of neighbouring columns of a lane straight into the pixels a row at a time
+// each column is filled from top to bottom and unfilled everywhere else in the lane
+void drawColumns(SDL_Surface* surface, int x, int count, int laneTop, int laneBottom,
+		 const int* top, const int* bottom, const Uint32* filled, const Uint32* unfilled)
+{
+  int bytesPerPixel = surface->format->BytesPerPixel;
+  int y, i;
+  for(y = laneTop; y < laneBottom; y++)
+    {
+      Uint8* row = (Uint8*)surface->pixels + y * surface->pitch + x * bytesPerPixel;
+      if(bytesPerPixel == 4)
+	{
+	  // the usual xrgb and argb case, simple enough for the compiler to vectorize
+	  Uint32* pixels = (Uint32*)row;
+	  for(i = 0; i < count; i++)
+	    pixels[i] = y >= top[i] && y < bottom[i] ? filled[i] : unfilled[i];
+	}
+      else
+	{
+	  for(i = 0; i < count; i++)
+	    writePixel(row + i * bytesPerPixel, bytesPerPixel, y >= top[i] && y < bottom[i] ? filled[i] : unfilled[i]);
+	}
+    }
+}
+
+// work through the bands of the current job until there are none left
+void runBands(struct workerPool* pool)
+{
+  int band;
+  while((band = __atomic_fetch_add(&pool->nextBand, 1, __ATOMIC_RELAXED)) < pool->bands)
+    pool->job(pool->data, band);
+}
+
+// a worker sleeps until theres a job, helps with it, then goes back to sleep
+int workerThread(void* data)
+{
+  struct workerPool* pool = (struct workerPool*)data;
+  int generation = 0;
+
+  SDL_LockMutex(pool->lock);
+  for(;;)
+    {
+      while(!pool->quit && pool->generation == generation)
+	SDL_CondWait(pool->wake, pool->lock);
+      if(pool->quit)
+	break;
+      generation = pool->generation;
+      SDL_UnlockMutex(pool->lock);
+
+      runBands(pool);
+
+      SDL_LockMutex(pool->lock);
+      if(--pool->pending == 0)
+	SDL_CondSignal(pool->finished);
+    }
+  SDL_UnlockMutex(pool->lock);
+  return 0;
+}
+
+// run a job over a number of bands with every thread of the pool
+// returns once all of the bands are done
+void parallelFor(struct workerPool* pool, int bands, void (*job)(void* data, int band), void* data)
+{
+  // not worth waking anybody for
+  if(pool->threads <= 1 || bands <= 1)
+    {
+      int band;
+      for(band = 0; band < bands; band++)
+	job(data, band);
+      return;
+    }
+
+  SDL_LockMutex(pool->lock);
+  pool->job = job;
+  pool->data = data;
+  pool->bands = bands;
+  pool->nextBand = 0;
+  pool->pending = pool->threads - 1;
+  pool->generation++;
+  SDL_CondBroadcast(pool->wake);
+  SDL_UnlockMutex(pool->lock);
+
+  // pitch in rather than just waiting
+  runBands(pool);
+
+  // the only place anything waits on the workers
+  SDL_LockMutex(pool->lock);
+  while(pool->pending > 0)
+    SDL_CondWait(pool->finished, pool->lock);
+  SDL_UnlockMutex(pool->lock);
+}
+
+// start up the worker threads
+// falls back to drawing on just the main thread if they cant be started
+int initWorkers(int threads)
+{
+  if(threads < 1)
+    threads = SDL_GetCPUCount();
+  workers.threads = 1;
+  if(threads <= 1)
+    return 0;
+
+  workers.lock = SDL_CreateMutex();
+  workers.wake = SDL_CreateCond();
+  workers.finished = SDL_CreateCond();
+  workers.workers = (SDL_Thread**)calloc(threads - 1, sizeof(SDL_Thread*));
+  if(workers.lock == NULL || workers.wake == NULL || workers.finished == NULL || workers.workers == NULL)
+    {
+      fprintf(stderr, "Could not create worker pool! SDL Error: %s\n", SDL_GetError());
+      return -1;
+    }
+
+  int i;
+  for(i = 0; i < threads - 1; i++)
+    {
+      workers.workers[i] = SDL_CreateThread(workerThread, "wavyWorker", &workers);
+      if(workers.workers[i] == NULL)
+	{
+	  fprintf(stderr, "Could not start worker thread! SDL Error: %s\n", SDL_GetError());
+	  break;
+	}
+      workers.threads++;
+    }
+  return 0;
+}
+
+// tell the worker threads to quit and wait for them
+void stopWorkers()
+{
+  if(workers.workers == NULL)
+    return;
+
+  SDL_LockMutex(workers.lock);
+  workers.quit = 1;
+  SDL_CondBroadcast(workers.wake);
+  SDL_UnlockMutex(workers.lock);
+
+  int i;
+  for(i = 0; i < workers.threads - 1; i++)
+    SDL_WaitThread(workers.workers[i], NULL);
+  free(workers.workers);
+  workers.workers = NULL;
+  SDL_DestroyCond(workers.finished);
+  SDL_DestroyCond(workers.wake);
+  SDL_DestroyMutex(workers.lock);
+  workers.threads = 1;
+}
+
+// which column of the whole file the leftmost column of a viewport is
+// columns are lined up on multiples of their width from the start of the file
+// so panning by any amount shows the same columns as before, just shifted over
+double firstColumn(struct region viewport, int width)
+{
+  double samplesPerPixel = 1.0 * (viewport.stop - viewport.start) / width;
+  return samplesPerPixel == 0 ? 0 : floor(viewport.start / samplesPerPixel);
+}
+
+// the first sample a column of a viewport shows
+int64_t columnSample(struct region viewport, int width, int column)
+{
+  double samplesPerPixel = 1.0 * (viewport.stop - viewport.start) / width;
+  if(samplesPerPixel == 0) return viewport.start;
+  return (int64_t)((firstColumn(viewport, width) + column) * samplesPerPixel);
+}
+
+// everything drawing one band of the waveform needs
+struct waveformJob
+{
+  SDL_Surface* surface;
+  struct audioBuffer buffer;
+  struct summary summary;
+  struct region viewport;
+  struct columnSpan columns;
+  struct palette colors;
+  int bands;
+};
+
+// draw a span of columns of the waveform on an already locked surface
+void drawWaveformColumns(struct waveformJob* job, struct columnSpan columns)
+{
+  SDL_Surface* surface = job->surface;
+  struct audioBuffer buffer = job->buffer;
+  struct palette colors = job->colors;
+
+  // get dimensions for conveniences
+  int width = surface->w;
+  int height = surface->h;
+
+  // viewport stuff
+  int64_t viewportStartSample = job->viewport.start;
+  int64_t viewportEndSample = job->viewport.stop;
+  int64_t sampleRange = viewportEndSample - viewportStartSample;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  double minSamplesPerPixel = max(1, samplesPerPixel);
+  double origin = firstColumn(job->viewport, width);
+  int samplePeak = INT16_MAX;
+
+  // work out a batch of columns at a time then fill them in together
+  // each channel gets its own lane stacked top to bottom
+  int top[DRAW_BATCH_COLUMNS];
+  int bottom[DRAW_BATCH_COLUMNS];
+  Uint32 filled[DRAW_BATCH_COLUMNS];
+  Uint32 unfilled[DRAW_BATCH_COLUMNS];
+  int batch;
+  for(batch = columns.start; batch < columns.stop; batch += DRAW_BATCH_COLUMNS)
+    {
+      int count = min(DRAW_BATCH_COLUMNS, columns.stop - batch);
+      int i;
+
+      // the appropriate waveform color depends on whether its in the user selected region or not
+      for(i = 0; i < count; i++)
+	{
+	  int64_t sampleIndex = (int64_t)((origin + batch + i) * samplesPerPixel);
+	  if(inSelection(sampleIndex))
+	    {
+	      filled[i] = colors.selectedFilled;
+	      unfilled[i] = colors.selectedUnfilled;
+	    }
+	  else
+	    {
+	      filled[i] = colors.filled;
+	      unfilled[i] = colors.unfilled;
+	    }
+	}
+
+      int channel;
+      for(channel = 0; channel < buffer.channels; channel++)
+	{
+	  int laneTop = height * channel / buffer.channels;
+	  int laneHeight = height * (channel + 1) / buffer.channels - laneTop;
+	  for(i = 0; i < count; i++)
+	    {
+	      // the sample index at this pixel
+	      int64_t sampleIndex = (int64_t)((origin + batch + i) * samplesPerPixel);
+
+	      // this is the sample percentage and pixel conversions
+	      float samplePercent = columnRootMeanSquare(buffer, job->summary, channel, sampleIndex, minSamplesPerPixel) / samplePeak;
+	      int filledHeight = laneHeight * samplePercent;
+	      int unfilledHeight = laneHeight - filledHeight;
+	      top[i] = laneTop + unfilledHeight / 2;
+	      bottom[i] = top[i] + filledHeight;
+	    }
+	  drawColumns(surface, batch, count, laneTop, laneTop + laneHeight, top, bottom, filled, unfilled);
+	}
+    }
+}
+
+// draw one band of the columns of a waveform job
+// bands never overlap so they can be drawn at the same time
+void drawWaveformBand(void* data, int band)
+{
+  struct waveformJob* job = (struct waveformJob*)data;
+  int width = job->columns.stop - job->columns.start;
+  struct columnSpan columns;
+  columns.start = job->columns.start + width * band / job->bands;
+  columns.stop = job->columns.start + width * (band + 1) / job->bands;
+  drawWaveformColumns(job, columns);
+}
+
+// draw a waveform on an sdl surface given a viewport
+// the columns get split into bands drawn by the threads of a worker pool
+void drawWaveform(struct workerPool* pool, SDL_Surface* surface, struct audioBuffer buffer, struct summary summary, struct region viewport, struct columnSpan columns)
+{
+  if(columns.stop <= columns.start)
+    return;
+
+  struct waveformJob job;
+  job.surface = surface;
+  job.buffer = buffer;
+  job.summary = summary;
+  job.viewport = viewport;
+  job.columns = columns;
+
+  // colors for this surface
+  job.colors = getPalette(surface->format);
+
+  // a couple of bands per thread evens things out when some columns cost more than others
+  // but very narrow bands arent worth the handoff
+  int width = columns.stop - columns.start;
+  job.bands = min(pool->threads * 2, (width + MIN_BAND_COLUMNS - 1) / MIN_BAND_COLUMNS);
+
+  // get at the pixels
+  if(SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0)
+    {
+      fprintf(stderr, "Could not lock surface! SDL Error: %s\n", SDL_GetError());
+      return;
+    }
+
+  parallelFor(pool, job.bands, drawWaveformBand, &job);
+
+  if(SDL_MUSTLOCK(surface))
+    SDL_UnlockSurface(surface);
+}
+
+// in place complex fft of interleaved real and imaginary parts
+// iterative radix 2, the size is half of SPECTRUM_SIZE
+void fft(float* data, int size, const float* twiddles)
+{
+  // put everything in bit reversed order first
+  int i, j = 0, k, span;
+  for(i = 1; i < size; i++)
+    {
+      int bit = size >> 1;
+      for(; j & bit; bit >>= 1)
+	j ^= bit;
+      j ^= bit;
+      if(i < j)
+	{
+	  float real = data[i * 2], imaginary = data[i * 2 + 1];
+	  data[i * 2] = data[j * 2];
+	  data[i * 2 + 1] = data[j * 2 + 1];
+	  data[j * 2] = real;
+	  data[j * 2 + 1] = imaginary;
+	}
+    }
+
+  // then combine butterflies of twice the span each pass
+  for(span = 1; span < size; span <<= 1)
+    {
+      int stride = size / (span * 2);
+      for(i = 0; i < size; i += span * 2)
+	for(k = 0; k < span; k++)
+	  {
+	    float* a = data + (i + k) * 2;
+	    float* b = a + span * 2;
+	    float wr = twiddles[k * stride * 2], wi = twiddles[k * stride * 2 + 1];
+	    float real = b[0] * wr - b[1] * wi;
+	    float imaginary = b[0] * wi + b[1] * wr;
+	    b[0] = a[0] - real;
+	    b[1] = a[1] - imaginary;
+	    a[0] += real;
+	    a[1] += imaginary;
+	  }
+    }
+}
+
+// get the power in each bin of a windowed frame of SPECTRUM_SIZE real samples
+// the even and odd samples go through a half size complex fft together then get split apart
+// the frame gets overwritten and there are SPECTRUM_SIZE / 2 + 1 powers
+void powerSpectrum(float* frame, float* power)
+{
+  int half = SPECTRUM_SIZE / 2;
+  fft(frame, half, spectrogram.twiddles);
+  int k;
+  for(k = 0; k <= half; k++)
+    {
+      const float* z = frame + (k % half) * 2;
+      const float* mirror = frame + ((half - k) % half) * 2;
+      float evenReal = (z[0] + mirror[0]) / 2, evenImaginary = (z[1] - mirror[1]) / 2;
+      float oddReal = (z[1] + mirror[1]) / 2, oddImaginary = (mirror[0] - z[0]) / 2;
+      float wr = spectrogram.split[k * 2], wi = spectrogram.split[k * 2 + 1];
+      float real = evenReal + wr * oddReal - wi * oddImaginary;
+      float imaginary = evenImaginary + wr * oddImaginary + wi * oddReal;
+      power[k] = real * real + imaginary * imaginary;
+    }
+}
+
+// work out the window, twiddles and bands the spectrogram is computed with
+void initSpectrumTables()
+{
+  int half = SPECTRUM_SIZE / 2;
+  int i;
+  for(i = 0; i < SPECTRUM_SIZE; i++)
+    spectrogram.window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / SPECTRUM_SIZE);
+  for(i = 0; i < half; i++)
+    {
+      spectrogram.twiddles[i * 2] = cos(2 * M_PI * i / half);
+      spectrogram.twiddles[i * 2 + 1] = -sin(2 * M_PI * i / half);
+    }
+  for(i = 0; i <= half; i++)
+    {
+      spectrogram.split[i * 2] = cos(2 * M_PI * i / SPECTRUM_SIZE);
+      spectrogram.split[i * 2 + 1] = -sin(2 * M_PI * i / SPECTRUM_SIZE);
+    }
+
+  // from the first bin above dc up to nyquist
+  // the lowest bands are narrower than a bin so they end up sharing
+  for(i = 0; i <= SPECTRUM_BANDS; i++)
+    spectrogram.bands[i] = (int)pow(half, 1.0 * i / SPECTRUM_BANDS);
+}
+
+// bytes of pixels in a spectrogram tile
+size_t spectrumTileSize(int channels)
+{
+  return (size_t)channels * SPECTRUM_BANDS * SPECTRUM_TILE_COLUMNS;
+}
+
+// compute the pixels of a spectrogram tile
+// each column is the loudness of each band around its frame, 0 being SPECTRUM_RANGE decibels below full scale or quieter
+// returns non-zero if it got cancelled part way
+int computeSpectrumTile(struct audioBuffer buffer, int level, int64_t index, Uint8* pixels, int* cancelled)
+{
+  int16_t frames[SPECTRUM_SIZE * buffer.channels];
+  int16_t run[SPECTRUM_SIZE];
+  float frame[SPECTRUM_SIZE];
+  float power[SPECTRUM_SIZE / 2 + 1];
+
+  // a full scale sine comes out of a hann window at a quarter of the size
+  double fullScale = 32768.0 * SPECTRUM_SIZE / 4;
+  fullScale *= fullScale;
+  int column, channel, band, i;
+  for(column = 0; column < SPECTRUM_TILE_COLUMNS; column++)
+    {
+      if(__atomic_load_n(cancelled, __ATOMIC_RELAXED))
+	return -1;
+
+      // the frame is centered on the column with silence past either end
+      int64_t start = ((index * SPECTRUM_TILE_COLUMNS + column) << level) - SPECTRUM_SIZE / 2;
+      int64_t first = max(start, 0);
+      int64_t stop = min(start + SPECTRUM_SIZE, buffer.length);
+      memset(frames, 0, sizeof(frames));
+      if(first < stop)
+	copySamples(buffer, first, stop - first, frames + (first - start) * buffer.channels);
+
+      for(channel = 0; channel < buffer.channels; channel++)
+	{
+	  for(i = 0; i < SPECTRUM_SIZE; i++)
+	    run[i] = frames[i * buffer.channels + channel];
+	  kernels.window(run, spectrogram.window, SPECTRUM_SIZE, frame);
+	  powerSpectrum(frame, power);
+
+	  // the loudest bin of each band in decibels
+	  for(band = 0; band < SPECTRUM_BANDS; band++)
+	    {
+	      float loudest = 0;
+	      int bin = spectrogram.bands[band];
+	      do
+		loudest = max(loudest, power[bin]);
+	      while(++bin < spectrogram.bands[band + 1]);
+	      double decibels = 10 * log10(loudest / fullScale + 1e-30);
+	      double level = 255 * (1 + decibels / SPECTRUM_RANGE);
+	      pixels[(channel * SPECTRUM_BANDS + band) * SPECTRUM_TILE_COLUMNS + column] = max(0.0, min(255.0, level));
+	    }
+	}
+    }
+  return 0;
+}
+
+// the queued tile the threads should do next, the one nearest the middle of the screen
+// only call with the lock held
+struct spectrumTile* nextSpectrumTile()
+{
+  struct spectrumTile* next = NULL;
+  int i;
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    {
+      struct spectrumTile* tile = &spectrogram.tiles[i];
+      if(tile->queued && (next == NULL || tile->priority < next->priority))
+	next = tile;
+    }
+  return next;
+}
+
+// let the interface know a tile is ready to show
+// the range of frames it covers goes in the event
+void notifySpectrumTile(int level, int64_t index)
+{
+  int64_t start = (index * SPECTRUM_TILE_COLUMNS) << level;
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = spectrumEvent;
+  event.user.code = level;
+  event.user.data1 = (void*)(uintptr_t)(Uint32)start;
+  event.user.data2 = (void*)(uintptr_t)(Uint32)(start >> 32);
+  SDL_PushEvent(&event);
+}
+
+// a spectrogram thread takes the most urgent tile, computes it to the side then swaps it in
+// it runs at low priority so the drawing and the audio always come first
+int spectrumThread(void* data)
+{
+  SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+  Uint8* pixels = (Uint8*)malloc(spectrumTileSize(spectrogram.channels));
+  if(pixels == NULL) return -1;
+
+  SDL_LockMutex(spectrogram.lock);
+  for(;;)
+    {
+      struct spectrumTile* tile;
+      while(!spectrogram.quit && (tile = nextSpectrumTile()) == NULL)
+	SDL_CondWait(spectrogram.wake, spectrogram.lock);
+      if(spectrogram.quit)
+	break;
+      tile->queued = 0;
+      tile->running = 1;
+      tile->cancelled = 0;
+      int level = tile->level;
+      int64_t index = tile->index;
+      struct audioBuffer buffer = retainAudio(loadedAudio());
+      SDL_UnlockMutex(spectrogram.lock);
+
+      int cancelled = computeSpectrumTile(buffer, level, index, pixels, &tile->cancelled);
+      releaseAudio(buffer);
+
+      SDL_LockMutex(spectrogram.lock);
+      tile->running = 0;
+      if(!cancelled && !tile->cancelled)
+	{
+	  Uint8* swap = tile->pixels;
+	  tile->pixels = pixels;
+	  pixels = swap;
+	  tile->length = buffer.length;
+	  notifySpectrumTile(level, index);
+	}
+      // it was wanted again after all once the thread had given up on it
+      else if(!tile->cancelled)
+	tile->queued = 1;
+    }
+  SDL_UnlockMutex(spectrogram.lock);
+  free(pixels);
+  return 0;
+}
+
+// start the threads that compute the spectrogram
+// leaving a core for the interface when there are enough
+// starting again after stopping begins with no tiles, since it might be for another file
+int startSpectrogram()
+{
+  initSpectrumTables();
+  spectrogram.channels = audioBuffer.channels;
+  spectrogram.quit = 0;
+  int i;
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    {
+      memset(&spectrogram.tiles[i], 0, sizeof(struct spectrumTile));
+      spectrogram.tiles[i].pixels = (Uint8*)malloc(spectrumTileSize(spectrogram.channels));
+      if(spectrogram.tiles[i].pixels == NULL)
+	{
+	  fprintf(stderr, "Out of memory for the spectrogram!\n");
+	  return -1;
+	}
+    }
+
+  int threads = max(1, (cliArgs.threads > 0 ? cliArgs.threads : SDL_GetCPUCount()) - 1);
+  spectrogram.lock = SDL_CreateMutex();
+  spectrogram.wake = SDL_CreateCond();
+  spectrogram.workers = (SDL_Thread**)calloc(threads, sizeof(SDL_Thread*));
+  if(spectrogram.lock == NULL || spectrogram.wake == NULL || spectrogram.workers == NULL)
+    {
+      fprintf(stderr, "Could not create spectrogram threads! SDL Error: %s\n", SDL_GetError());
+      return -1;
+    }
+  for(i = 0; i < threads; i++)
+    {
+      spectrogram.workers[i] = SDL_CreateThread(spectrumThread, "wavySpectrum", NULL);
+      if(spectrogram.workers[i] == NULL)
+	{
+	  fprintf(stderr, "Could not start spectrogram thread! SDL Error: %s\n", SDL_GetError());
+	  break;
+	}
+      spectrogram.threads++;
+    }
+  return spectrogram.threads > 0 ? 0 : -1;
+}
+
+// tell the spectrogram threads to quit and wait for them
+void stopSpectrogram()
+{
+  if(spectrogram.workers == NULL)
+    return;
+
+  SDL_LockMutex(spectrogram.lock);
+  spectrogram.quit = 1;
+  SDL_CondBroadcast(spectrogram.wake);
+  SDL_UnlockMutex(spectrogram.lock);
+
+  int i;
+  for(i = 0; i < spectrogram.threads; i++)
+    SDL_WaitThread(spectrogram.workers[i], NULL);
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    free(spectrogram.tiles[i].pixels);
+  free(spectrogram.workers);
+  spectrogram.workers = NULL;
+  SDL_DestroyCond(spectrogram.wake);
+  SDL_DestroyMutex(spectrogram.lock);
+  spectrogram.threads = 0;
+}
+
+// find a tile in the cache
+// only call with the lock held
+struct spectrumTile* findSpectrumTile(int level, int64_t index)
+{
+  int i;
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    {
+      struct spectrumTile* tile = &spectrogram.tiles[i];
+      if(tile->level == level && tile->index == index && (tile->length > 0 || tile->queued || tile->running))
+	return tile;
+    }
+  return NULL;
+}
+
+// the zoom level spectrogram tiles get computed at for a viewport
+// the columns are spaced as far apart as they can be without being further apart than the pixels
+int spectrumLevel(struct region viewport, int width)
+{
+  double samplesPerPixel = fabs(1.0 * (viewport.stop - viewport.start) / width);
+  return samplesPerPixel < 2 ? 0 : (int)log2(samplesPerPixel);
+}
+
+// ask for a tile to be computed if it isnt already, or again if more audio came in around it
+// the least recently wanted tile makes way for it if its not in the cache
+// only call with the lock held
+void wantSpectrumTile(int level, int64_t index, int priority, int64_t length)
+{
+  struct spectrumTile* tile = findSpectrumTile(level, index);
+  if(tile == NULL)
+    {
+      int i;
+      for(i = 0; i < SPECTRUM_TILES; i++)
+	{
+	  struct spectrumTile* candidate = &spectrogram.tiles[i];
+	  if(candidate->running || candidate->used == spectrogram.clock) continue;
+	  if(tile == NULL || candidate->used < tile->used)
+	    tile = candidate;
+	}
+      if(tile == NULL) return;
+      tile->level = level;
+      tile->index = index;
+      tile->length = 0;
+    }
+  tile->used = spectrogram.clock;
+  __atomic_store_n(&tile->cancelled, 0, __ATOMIC_RELAXED);
+
+  // the audio a tile can see ends half a frame past its last column
+  int64_t reach = min(((index + 1) * SPECTRUM_TILE_COLUMNS << level) + SPECTRUM_SIZE / 2, length);
+  if(!tile->running && tile->length < reach)
+    {
+      tile->queued = 1;
+      tile->priority = priority;
+    }
+}
+
+// ask for the spectrogram tiles the viewport shows, from the middle of the screen out
+// and the ones either side of it so a small pan has them already
+// anything that was asked for before but isnt on the screen anymore gets cancelled
+void requestSpectrumTiles()
+{
+  int width = mainSurface->w;
+  int64_t length = loadedLength(&audioBuffer);
+  int level = spectrumLevel(viewport, width);
+  int64_t tileFrames = (int64_t)SPECTRUM_TILE_COLUMNS << level;
+  // the viewport can run backwards
+  int64_t first = max(min(viewport.start, viewport.stop), 0) / tileFrames;
+  int64_t last = (min(max(viewport.start, viewport.stop), length) - 1) / tileFrames;
+  int64_t middle = (viewport.start + viewport.stop) / 2 / tileFrames;
+
+  SDL_LockMutex(spectrogram.lock);
+  spectrogram.clock++;
+  int64_t index;
+  for(index = max(first - 1, 0); index <= last + 1 && index - first < SPECTRUM_TILES / 2; index++)
+    {
+      if(index * tileFrames >= length) break;
+      int offscreen = index < first || index > last;
+      wantSpectrumTile(level, index, (offscreen ? SPECTRUM_TILES : 0) + llabs(index - middle), length);
+    }
+
+  // let go of anything that isnt wanted anymore
+  int i, queued = 0;
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    {
+      struct spectrumTile* tile = &spectrogram.tiles[i];
+      if(tile->used != spectrogram.clock)
+	{
+	  tile->queued = 0;
+	  if(tile->running) __atomic_store_n(&tile->cancelled, 1, __ATOMIC_RELAXED);
+	}
+      queued += tile->queued;
+    }
+  if(queued > 0)
+    SDL_CondBroadcast(spectrogram.wake);
+  SDL_UnlockMutex(spectrogram.lock);
+}
+
+// cancel all of the spectrogram tiles being computed
+void cancelSpectrumTiles()
+{
+  if(spectrogram.workers == NULL) return;
+  SDL_LockMutex(spectrogram.lock);
+  spectrogram.clock++;
+  int i;
+  for(i = 0; i < SPECTRUM_TILES; i++)
+    {
+      spectrogram.tiles[i].queued = 0;
+      __atomic_store_n(&spectrogram.tiles[i].cancelled, 1, __ATOMIC_RELAXED);
+    }
+  SDL_UnlockMutex(spectrogram.lock);
+}
+
+// mix two colors, a weight of 256 being all of the second one
+Uint32 mixColor(SDL_PixelFormat* format, const Uint8* a, const Uint8* b, int weight)
+{
+  return SDL_MapRGB(format, a[0] + (b[0] - a[0]) * weight / 256, a[1] + (b[1] - a[1]) * weight / 256,
+		    a[2] + (b[2] - a[2]) * weight / 256);
+}
+
+// get the spectrogram colors mapped to a surface format
+// quiet to loud goes black, purple, red, orange and white
+// and the selection is tinted the same yellow as the waveform's
+struct spectrumPalette* getSpectrumPalette(SDL_PixelFormat* format)
+{
+  static const Uint8 stops[5][3] = { { 0, 0, 0 }, { 64, 0, 128 }, { 192, 0, 64 }, { 255, 160, 0 }, { 255, 255, 255 } };
+  static const Uint8 yellow[3] = { 255, 255, 0 };
+  if(spectrumPalette.format != format->format)
+    {
+      spectrumPalette.format = format->format;
+      int i;
+      for(i = 0; i < 256; i++)
+	{
+	  int stop = min(i / 64, 3);
+	  Uint8 color[3];
+	  int j;
+	  for(j = 0; j < 3; j++)
+	    color[j] = stops[stop][j] + (stops[stop + 1][j] - stops[stop][j]) * (i - stop * 64) / (stop == 3 ? 63 : 64);
+	  spectrumPalette.colors[i] = SDL_MapRGB(format, color[0], color[1], color[2]);
+	  spectrumPalette.selectedColors[i] = mixColor(format, color, yellow, 64);
+	}
+    }
+  return &spectrumPalette;
+}
+
+// everything drawing one band of the spectrogram needs
+struct spectrogramJob
+{
+  SDL_Surface* surface;
+  struct region viewport;
+  struct columnSpan columns;
+  struct spectrumPalette* colors;
+  struct palette background; // for where theres no tile yet
+  int level;
+  int bands;
+};
+
+// the tile to show a column from at a frame
+// the one at the right level if its ready, otherwise the nearest level thats got something
+// returns the column of the tile through column
+// only call with the lock held
+struct spectrumTile* spectrumTileAt(int level, int64_t position, int* column)
+{
+  int i;
+  for(i = 0; i <= SPECTRUM_LEVEL_SEARCH * 2; i++)
+    {
+      // the right level then one finer, one coarser, two finer and so on
+      int tryLevel = level + (i % 2 ? -(i + 1) / 2 : i / 2);
+      if(tryLevel < 0) continue;
+      int64_t tileColumn = position >> tryLevel;
+      struct spectrumTile* tile = findSpectrumTile(tryLevel, tileColumn / SPECTRUM_TILE_COLUMNS);
+      if(tile != NULL && tile->length > 0)
+	{
+	  *column = tileColumn % SPECTRUM_TILE_COLUMNS;
+	  return tile;
+	}
+    }
+  return NULL;
+}
+
+// draw one band of the columns of a spectrogram job
+// each channel gets its own lane like the waveform, low frequencies at the bottom
+void drawSpectrogramBand(void* data, int band)
+{
+  struct spectrogramJob* job = (struct spectrogramJob*)data;
+  SDL_Surface* surface = job->surface;
+  int width = surface->w;
+  int height = surface->h;
+  int bytesPerPixel = surface->format->BytesPerPixel;
+  struct palette colors = job->background;
+  int64_t sampleRange = job->viewport.stop - job->viewport.start;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  double origin = firstColumn(job->viewport, width);
+  int channels = spectrogram.channels;
+
+  int span = job->columns.stop - job->columns.start;
+  int start = job->columns.start + span * band / job->bands;
+  int stop = job->columns.start + span * (band + 1) / job->bands;
+  int x, y;
+  for(x = start; x < stop; x++)
+    {
+      int64_t sampleIndex = samplesPerPixel == 0 ? job->viewport.start : (int64_t)((origin + x) * samplesPerPixel);
+      int selected = inSelection(sampleIndex);
+      const Uint32* palette = selected ? job->colors->selectedColors : job->colors->colors;
+      int column;
+      struct spectrumTile* tile = spectrumTileAt(job->level, sampleIndex, &column);
+      Uint8* pixel = (Uint8*)surface->pixels + x * bytesPerPixel;
+      for(y = 0; y < height; y++, pixel += surface->pitch)
+	{
+	  if(tile == NULL)
+	    {
+	      writePixel(pixel, bytesPerPixel, selected ? colors.selectedUnfilled : colors.unfilled);
+	      continue;
+	    }
+	  int channel = y * channels / height;
+	  int laneTop = height * channel / channels;
+	  int laneHeight = height * (channel + 1) / channels - laneTop;
+	  int row = (laneHeight - 1 - (y - laneTop)) * SPECTRUM_BANDS / laneHeight;
+	  writePixel(pixel, bytesPerPixel,
+		     palette[tile->pixels[(channel * SPECTRUM_BANDS + row) * SPECTRUM_TILE_COLUMNS + column]]);
+	}
+    }
+}
+
+// draw the spectrogram on an sdl surface given a viewport
+// only what the tiles already have gets drawn, so it never waits on them being computed
+void drawSpectrogram(SDL_Surface* surface, struct region viewport, struct columnSpan columns)
+{
+  if(columns.stop <= columns.start || spectrogram.workers == NULL)
+    return;
+
+  struct spectrogramJob job;
+  job.surface = surface;
+  job.viewport = viewport;
+  job.columns = columns;
+  job.colors = getSpectrumPalette(surface->format);
+  job.background = getPalette(surface->format);
+  job.level = spectrumLevel(viewport, surface->w);
+  int width = columns.stop - columns.start;
+  job.bands = min(workers.threads * 2, (width + MIN_BAND_COLUMNS - 1) / MIN_BAND_COLUMNS);
+
+  if(SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0)
+    {
+      fprintf(stderr, "Could not lock surface! SDL Error: %s\n", SDL_GetError());
+      return;
+    }
+
+  // the threads can only swap tiles in between draws
+  SDL_LockMutex(spectrogram.lock);
+  parallelFor(&workers, job.bands, drawSpectrogramBand, &job);
+  SDL_UnlockMutex(spectrogram.lock);
+
+  if(SDL_MUSTLOCK(surface))
+    SDL_UnlockSurface(surface);
+}
+
+// whether the playhead gets drawn over a column
+// this has to match up with how drawWaveform picks the sample of each column
+int playheadInColumn(int column, int64_t position)
+{
+  int width = mainSurface->w;
+  int64_t sampleRange = viewport.stop - viewport.start;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  double minSamplesPerPixel = max(1, samplesPerPixel);
+  int64_t sampleIndex = columnSample(viewport, width, column);
+  return inRange(position, sampleIndex, sampleIndex + minSamplesPerPixel);
+}
+
+// get the columns the playhead covers at a play position
+struct columnSpan playheadColumns(int64_t position)
+{
+  int width = mainSurface->w;
+  int64_t sampleRange = viewport.stop - viewport.start;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  struct columnSpan span = { 0, 0 };
+  if(sampleRange == 0)
+    return span;
+
+  // guess the column from the position then look right around it
+  // since the sample of each column got rounded off
+  double guess = position / samplesPerPixel - firstColumn(viewport, width);
+  int column = max(-2.0, min((double)width + 2, guess));
+  int i;
+  for(i = column - 2; i <= column + 2; i++)
+    if(i >= 0 && i < width && playheadInColumn(i, position))
+      break;
+  if(i > column + 2 || i < 0 || i >= width)
+    return span;
+
+  // when zoomed in far the playhead covers a few columns
+  span.start = i;
+  span.stop = i + 1;
+  while(span.start > 0 && playheadInColumn(span.start - 1, position))
+    span.start--;
+  while(span.stop < width && playheadInColumn(span.stop, position))
+    span.stop++;
+  return span;
+}
+
+// add a span of columns to a set of damage
+// merges it with any spans it touches and lumps everything together if it runs out of room
+void addDamage(struct damage* damage, int start, int stop)
+{
+  // only whats in the window matters
+  start = max(start, 0);
+  stop = min(stop, mainSurface->w);
+  if(start >= stop)
+    return;
+
+  // absorb any spans this one touches
+  int i = 0;
+  while(i < damage->count)
+    {
+      struct columnSpan span = damage->spans[i];
+      if(span.start <= stop && start <= span.stop)
+	{
+	  start = min(start, span.start);
+	  stop = max(stop, span.stop);
+	  damage->spans[i] = damage->spans[--damage->count];
+	}
+      else
+	i++;
+    }
+
+  // too many separate spans so just cover all of them with one
+  if(damage->count == MAX_DAMAGE_SPANS)
+    {
+      for(i = 0; i < damage->count; i++)
+	{
+	  start = min(start, damage->spans[i].start);
+	  stop = max(stop, damage->spans[i].stop);
+	}
+      damage->count = 0;
+    }
+
+  struct columnSpan span = { start, stop };
+  damage->spans[damage->count++] = span;
+}
+
+// mark the columns showing a range of samples as needing rendering again
+void damageSamples(int64_t a, int64_t b)
+{
+  int width = mainSurface->w;
+  int64_t sampleRange = viewport.stop - viewport.start;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  double minSamplesPerPixel = max(1, samplesPerPixel);
+  if(sampleRange == 0)
+    {
+      addDamage(&staleColumns, 0, width);
+      return;
+    }
+
+  // a column shows the samples from its own sample onwards
+  // so columns starting a bit before the range can see it too
+  double origin = firstColumn(viewport, width);
+  double first = (min(a, b) - minSamplesPerPixel) / samplesPerPixel - origin;
+  double last = (max(a, b) + 1) / samplesPerPixel - origin;
+  first = max(-2.0, min((double)width + 2, first));
+  last = max(-2.0, min((double)width + 2, last));
+  addDamage(&staleColumns, (int)min(first, last) - 1, (int)max(first, last) + 2);
+}
+
+// mark the whole window as needing to be put on the screen again
+void damageWindow()
+{
+  addDamage(&dirtyColumns, 0, mainSurface->w);
+}
+
+// let the interface know an export has moved along
+// these come at most every so often unless forced
+void notifyExportProgress(struct exportJob* job, int force)
+{
+  Uint32 now = SDL_GetTicks();
+  if(!force && now - job->lastProgress < LOAD_PROGRESS_INTERVAL) return;
+  job->lastProgress = now;
+
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = exportProgressEvent;
+  SDL_PushEvent(&event);
+}
+
+// start a program with a pipe to or from it like popen
+// but the arguments are handed over as they are instead of through a shell
+// so file names can have quotes or anything else in them
+// writing says whether the pipe goes to its input instead of coming from its output
+// returns NULL if it couldnt be started
+FILE* openProcess(char* const* args, int writing, pid_t* process)
+{
+  int fds[2];
+  if(pipe(fds)) return NULL;
+  // the ends stay here, otherwise another program started later keeps them open
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[writing ? 0 : 1], writing ? STDIN_FILENO : STDOUT_FILENO);
+  extern char** environ;
+  int failed = posix_spawnp(process, args[0], &actions, NULL, args, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[writing ? 0 : 1]);
+  if(failed)
+    {
+      close(fds[writing ? 1 : 0]);
+      return NULL;
+    }
+  FILE* pipe = fdopen(fds[writing ? 1 : 0], writing ? "w" : "r");
+  if(pipe == NULL)
+    {
+      close(fds[writing ? 1 : 0]);
+      waitpid(*process, NULL, 0);
+    }
+  return pipe;
+}
+
+// close the pipe to a program and wait for it to finish like pclose
+// returns non-zero if it didnt exit cleanly
+int closeProcess(FILE* pipe, pid_t process)
+{
+  fclose(pipe);
+  int status;
+  while(waitpid(process, &status, 0) < 0)
+    if(errno != EINTR) return -1;
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+// save the region of an export job to an audio file using ffmpeg
+// returns non-zero if ffmpeg couldnt be run or didnt like it
+int saveAudioToFile(struct exportJob* job)
+{
+  // save the raw data with ffmpeg
+  // in whatever channels and rate it was loaded with
+  struct audioBuffer buffer = job->buffer;
+  char rate[16], channels[16];
+  snprintf(rate, sizeof(rate), "%d", buffer.sampleRate);
+  snprintf(channels, sizeof(channels), "%d", buffer.channels);
+  char* args[] = { "ffmpeg", "-v", "error", "-y", "-f", "s16le", "-ar", rate, "-ac", channels,
+		   "-i", "-", job->path, NULL };
+  pid_t process;
+  FILE* pipe = openProcess(args, 1, &process);
+  if(pipe == NULL)
+    return -1;
+
+  int64_t start = job->start;
+  int failed = 0;
+  while(start < job->stop && !failed)
+    {
+      int span = min(job->stop - start, (int64_t)chunkRemaining(buffer.samples, start));
+      failed = fwrite(sampleAt(buffer, start), buffer.samples.elementSize, span, pipe) != (size_t)span;
+      start += span;
+      __atomic_store_n(&job->written, start - job->start, __ATOMIC_RELAXED);
+      notifyExportProgress(job, 0);
+    }
+  return closeProcess(pipe, process) || failed;
+}
+
+// run an export in the background
+int exportThread(void* data)
+{
+  struct exportJob* job = (struct exportJob*)data;
+  if(saveAudioToFile(job))
+    fprintf(stderr, "Could not export to %s!\n", job->path);
+
+  // let the interface clean up after it and start the next one
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+  notifyExportProgress(job, 1);
+  return 0;
+}
+
+// work out the file an export goes to
+// the first %d is replaced with the number of the export and a leading ~ with the home directory
+void exportPath(char* path, size_t size, const char* pattern, int number)
+{
+  const char* home = getenv("HOME");
+  int length = 0;
+  if(pattern[0] == '~' && (pattern[1] == '/' || pattern[1] == '\0') && home != NULL)
+    {
+      length = snprintf(path, size, "%s", home);
+      pattern++;
+    }
+
+  const char* numberAt = strstr(pattern, "%d");
+  if(numberAt == NULL)
+    snprintf(path + length, size - length, "%s", pattern);
+  else
+    snprintf(path + length, size - length, "%.*s%d%s", (int)(numberAt - pattern), pattern, number, numberAt + 2);
+}
+
+// throw away the exports that are finished
+void reapExports()
+{
+  struct exportJob** link = &exports;
+  while(*link != NULL)
+    {
+      struct exportJob* job = *link;
+      if(!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+	{
+	  link = &job->next;
+	  continue;
+	}
+      if(job->thread != NULL)
+	SDL_WaitThread(job->thread, NULL);
+      releaseAudio(job->buffer);
+      *link = job->next;
+      free(job);
+    }
+}
+
+// start as many of the waiting exports as are allowed to run at once
+// an export waits for any earlier one going to the same file so they dont write over each other
+void startExports()
+{
+  int running = 0;
+  struct exportJob* job;
+  for(job = exports; job != NULL; job = job->next)
+    if(job->thread != NULL) running++;
+
+  for(job = exports; job != NULL && running < MAX_RUNNING_EXPORTS; job = job->next)
+    {
+      if(job->thread != NULL || job->done) continue;
+
+      struct exportJob* earlier;
+      for(earlier = exports; earlier != job; earlier = earlier->next)
+	if(strcmp(earlier->path, job->path) == 0) break;
+      if(earlier != job) continue;
+
+      job->thread = SDL_CreateThread(exportThread, "wavyExport", job);
+      if(job->thread == NULL)
+	{
+	  fprintf(stderr, "Could not start export to %s! SDL Error: %s\n", job->path, SDL_GetError());
+	  job->done = 1;
+	  continue;
+	}
+      running++;
+    }
+}
+
+// wait for every export to be written out
+// so nothing gets lost by quitting early
+void finishExports()
+{
+  if(exports != NULL)
+    fprintf(stderr, "Waiting for exports to finish...\n");
+  for(;;)
+    {
+      reapExports();
+      startExports();
+      if(exports == NULL) break;
+
+      // wait on the oldest one running, reaping it takes care of the rest
+      struct exportJob* job;
+      for(job = exports; job != NULL && job->thread == NULL; job = job->next);
+      if(job == NULL) continue;
+      SDL_WaitThread(job->thread, NULL);
+      job->thread = NULL;
+    }
+}
+
+// export the selected region of audio in the background
+void exportSnippet()
+{
+  // can only export a snippet if there's a selection to export
+  if(!selectionExists())
+    return;
+
+  struct exportJob* job = (struct exportJob*)calloc(1, sizeof(struct exportJob));
+  if(job == NULL)
+    {
+      fprintf(stderr, "Could not allocate export!\n");
+      return;
+    }
+
+  // hold on to the samples rather than copying them
+  // only whats loaded so far can go out
+  job->buffer = retainAudio(loadedAudio());
+  job->start = max(0, min(min(selection.start, selection.stop), job->buffer.length));
+  job->stop = max(0, min(max(selection.start, selection.stop), job->buffer.length));
+  exportPath(job->path, sizeof(job->path), cliArgs.exportPath, ++exportCount);
+
+  // queue it up behind the others
+  struct exportJob** link = &exports;
+  while(*link != NULL)
+    link = &(*link)->next;
+  *link = job;
+  notifyExportProgress(job, 1);
+  startExports();
+}
+
+// update the window title to show status
+void updateWindowTitle()
+{
+  char title[128];
+  int length = sprintf(title, "Wavy: [%s] [%s] [%s]",
+		       isPlaying() ? "P" : "-",
+		       looping ? "L" : "-",
+		       transport.reversed ? "R" : "-");
+  if(playbackRate != 1)
+    length += sprintf(title + length, " [%.2fx]", playbackRate);
+  if(cliArgs.fileCount > 1)
+    length += sprintf(title + length, " [%d/%d]", playlist.current + 1, cliArgs.fileCount);
+
+  // show how far along loading is if its still going
+  if(!loadingDone())
+    {
+      int64_t loaded = loadedLength(&audioBuffer);
+      if(loader.expectedLength > 0)
+	length += sprintf(title + length, " [loading %d%%]", (int)(100.0 * loaded / loader.expectedLength));
+      else
+	length += sprintf(title + length, " [loading %llds]", (long long)(loaded / audioBuffer.sampleRate));
+    }
+
+  // and how far along the exports are
+  int count = 0;
+  double written = 0, total = 0;
+  struct exportJob* job;
+  for(job = exports; job != NULL; job = job->next)
+    {
+      count++;
+      written += __atomic_load_n(&job->written, __ATOMIC_RELAXED);
+      total += job->stop - job->start;
+    }
+  if(count > 0)
+    sprintf(title + length, " [exporting %d: %d%%]", count, total > 0 ? (int)(100 * written / total) : 0);
+  SDL_SetWindowTitle(mainWindow, title);
+}
+
+// the glyphs of the tiny font for the stats overlay
+// a row of three pixels in each number, most significant bit on the left
+const Uint8 fontGlyphs[][FONT_HEIGHT] =
+  {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, {5, 5, 7, 1, 1}, // 0-4
+    {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, // 5-9
+    {2, 5, 7, 5, 5}, {6, 5, 6, 5, 6}, {3, 4, 4, 4, 3}, {6, 5, 5, 5, 6}, {7, 4, 6, 4, 7}, // a-e
+    {7, 4, 6, 4, 4}, {3, 4, 5, 5, 3}, {5, 5, 7, 5, 5}, {7, 2, 2, 2, 7}, {1, 1, 1, 5, 2}, // f-j
+    {5, 5, 6, 5, 5}, {4, 4, 4, 4, 7}, {5, 7, 7, 5, 5}, {6, 5, 5, 5, 5}, {2, 5, 5, 5, 2}, // k-o
+    {6, 5, 6, 4, 4}, {2, 5, 5, 6, 3}, {6, 5, 6, 5, 5}, {3, 4, 2, 1, 6}, {7, 2, 2, 2, 2}, // p-t
+    {5, 5, 5, 5, 7}, {5, 5, 5, 5, 2}, {5, 5, 7, 7, 5}, {5, 5, 2, 5, 5}, {5, 5, 2, 2, 2}, // u-y
+    {7, 1, 2, 4, 7}, {0, 0, 0, 0, 2}, {0, 2, 0, 2, 0}, {1, 1, 2, 4, 4}, {5, 1, 2, 4, 5}, // z . : / %
+    {0, 0, 7, 0, 0} // -
+  };
+
+// draw a line of text in the tiny font
+// anything its missing is left as a space
+void drawText(SDL_Surface* surface, int x, int y, const char* text, Uint32 color)
+{
+  for(; *text != '\0'; text++, x += (FONT_WIDTH + 1) * FONT_SCALE)
+    {
+      const char* found = strchr(FONT_CHARACTERS, *text);
+      if(found == NULL) continue;
+      const Uint8* glyph = fontGlyphs[found - FONT_CHARACTERS];
+      int row, column;
+      for(row = 0; row < FONT_HEIGHT; row++)
+	for(column = 0; column < FONT_WIDTH; column++)
+	  if(glyph[row] & (4 >> column))
+	    {
+	      SDL_Rect pixel = { x + column * FONT_SCALE, y + row * FONT_SCALE, FONT_SCALE, FONT_SCALE };
+	      SDL_FillRect(surface, &pixel, color);
+	    }
+    }
+}
+
+// work out the text of the stats overlay
+void formatStatsOverlay()
+{
+  struct timing* frame = &timings[TIMING_FRAME];
+  struct timing* callback = &timings[TIMING_REQUEST_AUDIO];
+  struct timing* interval = &timings[TIMING_AUDIO_INTERVAL];
+  snprintf(stats.overlay[0], STATS_LINE_LENGTH, "FRAME MS P50 %.2f P99 %.2f MAX %.2f",
+	   timingPercentile(frame, 0.5), timingPercentile(frame, 0.99),
+	   tickMilliseconds(__atomic_load_n(&frame->max, __ATOMIC_RELAXED)));
+  snprintf(stats.overlay[1], STATS_LINE_LENGTH, "AUDIO MS RUN P99 %.2f MAX %.2f",
+	   timingPercentile(callback, 0.99),
+	   tickMilliseconds(__atomic_load_n(&callback->max, __ATOMIC_RELAXED)));
+  snprintf(stats.overlay[2], STATS_LINE_LENGTH, "AUDIO MS GAP P99 %.2f / %.2f",
+	   timingPercentile(interval, 0.99), tickMilliseconds(stats.deadline));
+  snprintf(stats.overlay[3], STATS_LINE_LENGTH, "UNDERRUNS %llu STARVED %llu",
+	   (unsigned long long)__atomic_load_n(&stats.underruns, __ATOMIC_RELAXED),
+	   (unsigned long long)__atomic_load_n(&stats.starved, __ATOMIC_RELAXED));
+  snprintf(stats.overlay[4], STATS_LINE_LENGTH, "EVENTS/S %.1f", stats.eventsPerSecond);
+  snprintf(stats.overlay[5], STATS_LINE_LENGTH, "RSS %.1f MB", residentMemory() / 1048576.0);
+
+  // the overlay covers up to the end of the longest line
+  int i, longest = 0;
+  for(i = 0; i < STATS_LINES; i++)
+    longest = max(longest, (int)strlen(stats.overlay[i]));
+  stats.overlayWidth = max(stats.overlayWidth, (longest * (FONT_WIDTH + 1) + 1) * FONT_SCALE);
+  stats.overlayChanged = 1;
+  stats.overlayFormatted = SDL_GetTicks();
+}
+
+// draw the stats overlay in the corner of the window
+void drawStatsOverlay(SDL_Surface* surface)
+{
+  struct palette colors = getPalette(surface->format);
+  int lineHeight = (FONT_HEIGHT + 1) * FONT_SCALE;
+  SDL_Rect box = { 0, 0, stats.overlayWidth, STATS_LINES * lineHeight + FONT_SCALE };
+  SDL_FillRect(surface, &box, colors.unfilled);
+  int i;
+  for(i = 0; i < STATS_LINES; i++)
+    drawText(surface, FONT_SCALE, FONT_SCALE + i * lineHeight, stats.overlay[i], colors.playhead);
+}
+
+// make sure theres a waveform layer that matches the window
+int prepareWaveformLayer()
+{
+  if(waveformLayer != NULL
+     && waveformLayer->w == mainSurface->w
+     && waveformLayer->h == mainSurface->h
+     && waveformLayer->format->format == mainSurface->format->format)
+    return 0;
+
+  // the window changed so start over with a fresh layer
+  SDL_FreeSurface(waveformLayer);
+  SDL_FreeSurface(stretchLayer);
+  waveformLayer = SDL_CreateRGBSurfaceWithFormat(0, mainSurface->w, mainSurface->h,
+						 mainSurface->format->BitsPerPixel,
+						 mainSurface->format->format);
+  stretchLayer = SDL_CreateRGBSurfaceWithFormat(0, mainSurface->w, mainSurface->h,
+						mainSurface->format->BitsPerPixel,
+						mainSurface->format->format);
+  if(waveformLayer == NULL || stretchLayer == NULL)
+    {
+      fprintf(stderr, "Could not create waveform layer! SDL Error: %s\n", SDL_GetError());
+      return -1;
+    }
+  SDL_SetSurfaceBlendMode(waveformLayer, SDL_BLENDMODE_NONE);
+  SDL_SetSurfaceBlendMode(stretchLayer, SDL_BLENDMODE_NONE);
+  staleColumns.count = 0;
+  roughColumns.count = 0;
+  addDamage(&staleColumns, 0, mainSurface->w);
+  damageWindow();
+  return 0;
+}
+
+// slide the pixels of the waveform layer over by some columns
+// a pan only has to render the columns that come into view after this
+void scrollWaveformLayer(int shift)
+{
+  int bytesPerPixel = waveformLayer->format->BytesPerPixel;
+  int width = waveformLayer->w;
+  if(SDL_MUSTLOCK(waveformLayer) && SDL_LockSurface(waveformLayer) < 0)
+    return;
+  int y;
+  for(y = 0; y < waveformLayer->h; y++)
+    {
+      Uint8* row = (Uint8*)waveformLayer->pixels + y * waveformLayer->pitch;
+      if(shift > 0)
+	memmove(row + shift * bytesPerPixel, row, (size_t)(width - shift) * bytesPerPixel);
+      else
+	memmove(row, row - shift * bytesPerPixel, (size_t)(width + shift) * bytesPerPixel);
+    }
+  if(SDL_MUSTLOCK(waveformLayer))
+    SDL_UnlockSurface(waveformLayer);
+
+  // whatever was only rough moves along with it
+  struct damage rough = roughColumns;
+  roughColumns.count = 0;
+  int i;
+  for(i = 0; i < rough.count; i++)
+    addDamage(&roughColumns, rough.spans[i].start + shift, rough.spans[i].stop + shift);
+}
+
+// stretch the columns of the waveform layer from one zoom to another
+// each column takes whichever old column its sample was in, so its right but blocky
+// those get marked rough and the ones that werent on the screen before get marked stale
+void stretchWaveformLayer(struct region from, struct region to)
+{
+  int width = waveformLayer->w;
+  int bytesPerPixel = waveformLayer->format->BytesPerPixel;
+  double fromWidth = 1.0 * (from.stop - from.start) / width;
+  double fromFirst = firstColumn(from, width);
+  int sources[width];
+  int x, y;
+  roughColumns.count = 0;
+  for(x = 0; x < width; x++)
+    {
+      double column = floor(columnSample(to, width, x) / fromWidth) - fromFirst;
+      sources[x] = column >= 0 && column < width ? (int)column : -1;
+      if(sources[x] < 0)
+	addDamage(&staleColumns, x, x + 1);
+      else
+	addDamage(&roughColumns, x, x + 1);
+    }
+
+  if(SDL_MUSTLOCK(waveformLayer) && SDL_LockSurface(waveformLayer) < 0)
+    return;
+  if(SDL_MUSTLOCK(stretchLayer) && SDL_LockSurface(stretchLayer) < 0)
+    {
+      SDL_UnlockSurface(waveformLayer);
+      return;
+    }
+  for(y = 0; y < waveformLayer->h; y++)
+    {
+      const Uint8* source = (const Uint8*)waveformLayer->pixels + y * waveformLayer->pitch;
+      Uint8* row = (Uint8*)stretchLayer->pixels + y * stretchLayer->pitch;
+      if(bytesPerPixel == 4)
+	{
+	  for(x = 0; x < width; x++)
+	    if(sources[x] >= 0)
+	      ((Uint32*)row)[x] = ((const Uint32*)source)[sources[x]];
+	}
+      else
+	{
+	  for(x = 0; x < width; x++)
+	    if(sources[x] >= 0)
+	      memcpy(row + x * bytesPerPixel, source + sources[x] * bytesPerPixel, bytesPerPixel);
+	}
+    }
+  if(SDL_MUSTLOCK(stretchLayer))
+    SDL_UnlockSurface(stretchLayer);
+  if(SDL_MUSTLOCK(waveformLayer))
+    SDL_UnlockSurface(waveformLayer);
+
+  SDL_Surface* swap = waveformLayer;
+  waveformLayer = stretchLayer;
+  stretchLayer = swap;
+}
+
+// make the most of what the waveform layer already shows when the viewport moves
+// a pan scrolls it and only renders whats newly exposed
+// a zoom stretches it as a stand in until the viewport settles and the exact columns get rendered
+void moveWaveformLayer(struct region from, struct region to)
+{
+  int width = waveformLayer->w;
+  double fromWidth = 1.0 * (from.stop - from.start) / width;
+  double toWidth = 1.0 * (to.stop - to.start) / width;
+  damageWindow();
+
+  // anything already waiting to be rendered was marked against some earlier viewport
+  // so theres no telling where it is now
+  if(staleColumns.count > 0 || fromWidth == 0 || toWidth == 0 || (fromWidth < 0) != (toWidth < 0))
+    {
+      roughColumns.count = 0;
+      addDamage(&staleColumns, 0, width);
+      return;
+    }
+
+  if(fromWidth != toWidth)
+    {
+      stretchWaveformLayer(from, to);
+      return;
+    }
+
+  double shift = firstColumn(from, width) - firstColumn(to, width);
+  if(fabs(shift) >= width)
+    {
+      roughColumns.count = 0;
+      addDamage(&staleColumns, 0, width);
+      return;
+    }
+  scrollWaveformLayer((int)shift);
+  if(shift > 0)
+    addDamage(&staleColumns, 0, (int)shift);
+  else
+    addDamage(&staleColumns, width + (int)shift, width);
+}
+
+// used to draw the screen when something changes
+// only the columns that actually changed get drawn and put on the screen
+void redrawScreen()
+{
+  Uint64 started = startTiming();
+  if(prepareWaveformLayer() < 0)
+    return;
+
+  // only draw as much as has been loaded at this point
+  struct audioBuffer buffer = loadedAudio();
+
+  // figure out what changed since the waveform layer was last rendered
+  // columns only stretched from another zoom get rendered properly once the viewport stops changing
+  struct region currentSelection = getSelection();
+  int i;
+  if(viewport.start != drawnViewport.start || viewport.stop != drawnViewport.stop)
+    moveWaveformLayer(drawnViewport, viewport);
+  else
+    {
+      for(i = 0; i < roughColumns.count; i++)
+	addDamage(&staleColumns, roughColumns.spans[i].start, roughColumns.spans[i].stop);
+      roughColumns.count = 0;
+    }
+  if(currentSelection.start != drawnSelection.start)
+    damageSamples(drawnSelection.start, currentSelection.start);
+  if(currentSelection.stop != drawnSelection.stop)
+    damageSamples(drawnSelection.stop, currentSelection.stop);
+  if(buffer.length != drawnLength)
+    damageSamples(drawnLength, buffer.length);
+  drawnViewport = viewport;
+  drawnSelection = currentSelection;
+  drawnLength = buffer.length;
+
+  // render the stale columns into the layer
+  // and they will need to go to the window too
+  // the spectrogram shows whatever tiles it has and asks for the rest
+  Uint64 drawStarted = startTiming();
+  if(showSpectrogram)
+    requestSpectrumTiles();
+  for(i = 0; i < staleColumns.count; i++)
+    {
+      struct columnSpan span = staleColumns.spans[i];
+      if(showSpectrogram)
+	drawSpectrogram(waveformLayer, viewport, span);
+      else
+	drawWaveform(&workers, waveformLayer, buffer, summary, viewport, span);
+      addDamage(&dirtyColumns, span.start, span.stop);
+    }
+  if(staleColumns.count > 0)
+    stopTiming(TIMING_DRAW_WAVEFORM, drawStarted);
+  staleColumns.count = 0;
+
+  // the stats overlay needs putting back if its text changed
+  if(showStats && stats.overlayChanged)
+    addDamage(&dirtyColumns, 0, stats.overlayWidth);
+  stats.overlayChanged = 0;
+
+  // the playhead needs erasing from where it was and drawing where it is
+  drawnPosition = getPlayPosition();
+  struct columnSpan playhead = playheadColumns(drawnPosition);
+  addDamage(&dirtyColumns, drawnPlayhead.start, drawnPlayhead.stop);
+  addDamage(&dirtyColumns, playhead.start, playhead.stop);
+  drawnPlayhead = playhead;
+
+  // copy the dirty columns from the layer to the window
+  SDL_Rect rects[MAX_DAMAGE_SPANS];
+  for(i = 0; i < dirtyColumns.count; i++)
+    {
+      struct columnSpan span = dirtyColumns.spans[i];
+      SDL_Rect rect = { span.start, 0, span.stop - span.start, mainSurface->h };
+      SDL_Rect destination = rect;
+      SDL_BlitSurface(waveformLayer, &rect, mainSurface, &destination);
+      rects[i] = rect;
+    }
+
+  // put the playhead on top
+  if(playhead.start < playhead.stop)
+    {
+      SDL_Rect rect = { playhead.start, 0, playhead.stop - playhead.start, mainSurface->h };
+      SDL_FillRect(mainSurface, &rect, getPalette(mainSurface->format).playhead);
+    }
+
+  // and the stats over everything
+  if(showStats)
+    drawStatsOverlay(mainSurface);
+
+  // and only push the columns that changed
+  if(dirtyColumns.count > 0)
+    SDL_UpdateWindowSurfaceRects(mainWindow, rects, dirtyColumns.count);
+  dirtyColumns.count = 0;
+
+  // come back next frame to finish off a zoom
+  if(roughColumns.count > 0)
+    redrawRequested = 1;
+  stopTiming(TIMING_FRAME, started);
+}
+
+// write all the stats out as json
+void dumpStats(FILE* file)
+{
+  fprintf(file, "{\"timings\": {");
+  int i, j;
+  for(i = 0; i < TIMING_KINDS; i++)
+    {
+      struct timing* timing = &timings[i];
+      Uint64 count = __atomic_load_n(&timing->count, __ATOMIC_RELAXED);
+      fprintf(file, "%s\"%s\": {\"count\": %llu, \"totalMs\": %.4f, \"minMs\": %.4f, \"maxMs\": %.4f, "
+	      "\"p50Ms\": %.3f, \"p99Ms\": %.3f, \"histogramUs\": [",
+	      i ? ", " : "", timingNames[i], (unsigned long long)count,
+	      tickMilliseconds(__atomic_load_n(&timing->total, __ATOMIC_RELAXED)),
+	      tickMilliseconds(__atomic_load_n(&timing->min, __ATOMIC_RELAXED)),
+	      tickMilliseconds(__atomic_load_n(&timing->max, __ATOMIC_RELAXED)),
+	      timingPercentile(timing, 0.5), timingPercentile(timing, 0.99));
+      for(j = 0; j < STATS_BUCKETS; j++)
+	fprintf(file, "%s%llu", j ? ", " : "",
+		(unsigned long long)__atomic_load_n(&timing->histogram[j], __ATOMIC_RELAXED));
+      fprintf(file, "]}");
+    }
+  fprintf(file, "}, \"audioBufferFrames\": %d, \"audioDeadlineMs\": %.4f, \"underruns\": %llu, \"starved\": %llu, "
+	  "\"events\": %llu, \"eventsPerSecond\": %.2f, \"residentBytes\": %lld}\n",
+	  playBufferSize, tickMilliseconds(stats.deadline),
+	  (unsigned long long)__atomic_load_n(&stats.underruns, __ATOMIC_RELAXED),
+	  (unsigned long long)__atomic_load_n(&stats.starved, __ATOMIC_RELAXED),
+	  (unsigned long long)stats.events, stats.eventsPerSecond, residentMemory());
+  fflush(file);
+}
+
+// ask for the stats to be dumped
+// the main loop does the actual dumping since this is a signal handler
+void requestStatsDump(int signal)
+{
+  statsDumpRequested = 1;
+}
+
+// ask for the screen to be redrawn
+// it only actually happens once a frame however many times this gets called
+void requestRedraw()
+{
+  redrawRequested = 1;
+}
+
+// redraw the screen if something asked for it and its been a frame since the last time
+// returns how many milliseconds until it can redraw, 0 if it did or theres nothing to do
+int presentFrame()
+{
+  if(!redrawRequested) return 0;
+  Uint32 since = SDL_GetTicks() - lastFrame;
+  if(since < frameInterval) return frameInterval - since;
+  redrawRequested = 0;
+  lastFrame = SDL_GetTicks();
+  redrawScreen();
+  return 0;
+}
+
+// play if paused, pause if playing
+void togglePlaying()
+{
+  __atomic_store_n(&playing, !isPlaying(), __ATOMIC_RELEASE);
+  updateWindowTitle();
+  // pause or unpause the audio device to match
+  // the gap while paused isnt a late callback
+  SDL_PauseAudioDevice(audioDevice, !isPlaying());
+  __atomic_store_n(&stats.lastCallback, 0, __ATOMIC_RELAXED);
+}
+
+// switch between the waveform and the spectrogram
+// the spectrogram threads only get started the first time its shown
+void toggleSpectrogram()
+{
+  if(spectrogram.workers == NULL && startSpectrogram())
+    {
+      stopSpectrogram();
+      return;
+    }
+  showSpectrogram = !showSpectrogram;
+  if(!showSpectrogram)
+    cancelSpectrumTiles();
+  addDamage(&staleColumns, 0, mainSurface->w);
+  requestRedraw();
+}
+
+// show or hide the stats overlay
+// showing it starts keeping stats if that wasnt already happening
+void toggleStats()
+{
+  showStats = !showStats;
+  if(showStats)
+    {
+      __atomic_store_n(&instrumenting, 1, __ATOMIC_RELAXED);
+      formatStatsOverlay();
+    }
+  else
+    addDamage(&dirtyColumns, 0, stats.overlayWidth);
+  requestRedraw();
+}
+
+// keep the stats up to date and show or dump them when wanted
+void updateStats()
+{
+  if(!instrumenting) return;
+  Uint32 now = SDL_GetTicks();
+  if(now - stats.rateStart >= 1000)
+    {
+      stats.eventsPerSecond = (stats.events - stats.rateEvents) * 1000.0 / (now - stats.rateStart);
+      stats.rateEvents = stats.events;
+      stats.rateStart = now;
+    }
+  if(statsDumpRequested)
+    {
+      statsDumpRequested = 0;
+      dumpStats(stdout);
+    }
+  if(showStats && now - stats.overlayFormatted >= STATS_OVERLAY_INTERVAL)
+    {
+      formatStatsOverlay();
+      requestRedraw();
+    }
+}
+
+// set how fast playback goes, as a multiple of normal speed
+void setPlaybackRate(double rate)
+{
+  playbackRate = min(max(rate, MIN_PLAYBACK_RATE), MAX_PLAYBACK_RATE);
+  __atomic_store_n(&transport.rate, (int)lround(playbackRate * (1 << RATE_SHIFT)), __ATOMIC_RELAXED);
+  updateWindowTitle();
+}
+
+// speed playback up or slow it down by some semitones
+// coming back to normal speed snaps to it exactly
+void changePlaybackRate(double semitones)
+{
+  double rate = playbackRate * pow(2, semitones / 12);
+  if(fabs(rate - 1) < 1e-6) rate = 1;
+  setPlaybackRate(rate);
+}
+
+// toggle whether audio plays backwards
+void toggleReversed()
+{
+  __atomic_store_n(&transport.reversed, !transport.reversed, __ATOMIC_RELAXED);
+  updateWindowTitle();
+}
+
+// toggle whether audio should loop
+void toggleLooping()
+{
+  __atomic_store_n(&looping, !looping, __ATOMIC_RELEASE);
+  updateWindowTitle();
+}
+
+// ask to go some way along the playlist, and whether to play what it gets to
+// the main loop does it next time round
+void skipTrack(int direction, int play)
+{
+  playlist.skip = direction;
+  playlist.play = play;
+}
+
+// pick up what the audio callback did since last time
+// and redraw the playhead if it moved
+void updatePlayback()
+{
+  // playback ran off the end so the device can be paused now
+  if(__atomic_exchange_n(&transport.ended, 0, __ATOMIC_ACQ_REL))
+    {
+      SDL_PauseAudioDevice(audioDevice, 1);
+      __atomic_store_n(&stats.lastCallback, 0, __ATOMIC_RELAXED);
+      updateWindowTitle();
+      requestRedraw();
+
+      // go on to the next file if playback couldnt carry straight on into it
+      if(!selectionExists() && !transport.reversed && playlist.current + 1 < cliArgs.fileCount)
+	skipTrack(1, 1);
+    }
+  else if(isPlaying() && getPlayPosition() != drawnPosition)
+    requestRedraw();
+}
+
+// carry on into the next buffer when playback gets to the end of this one
+// only when theres one ready and playback isnt held to a selection
+// returns the buffer to carry on with or NULL to stop
+struct audioBuffer* switchBuffers(struct region selection)
+{
+  if(selection.start != selection.stop) return NULL;
+  struct audioBuffer* next = __atomic_exchange_n(&transport.next, NULL, __ATOMIC_ACQ_REL);
+  if(next == NULL) return NULL;
+  __atomic_store_n(&transport.buffer, next, __ATOMIC_RELEASE);
+  __atomic_store_n(&transport.switched, 1, __ATOMIC_RELEASE);
+  return next;
+}
+
+// play at some other rate or backwards into the output
+// each frame is interpolated between the two frames either side of where playback is
+// the frames get gathered into pairs here and the kernels weigh them up
+// returns where playback got to
+int64_t playVarispeed(struct audioBuffer buffer, struct region selection, int done, int64_t position,
+		      int16_t* output, int frames, int keepStats)
+{
+  int16_t pairs[INTERPOLATE_SAMPLES * 2], weights[INTERPOLATE_SAMPLES * 2];
+  struct audioBuffer* nextBuffer;
+  int channels = buffer.channels;
+  int step = __atomic_load_n(&transport.rate, __ATOMIC_RELAXED);
+  if(__atomic_load_n(&transport.reversed, __ATOMIC_RELAXED))
+    step = -step;
+
+  // the same stopping points as playing forwards at normal speed
+  int64_t end, start;
+  if(selection.start != selection.stop)
+    {
+      end = max(selection.start, selection.stop);
+      start = min(selection.start, selection.stop);
+    }
+  else
+    {
+      end = buffer.length;
+      start = 0;
+    }
+  int starved = 0;
+  if(end >= buffer.length && !done)
+    {
+      end = buffer.length;
+      starved = 1;
+    }
+  // and only the part of the selection inside the audio
+  start = max(start, 0);
+  end = min(end, buffer.length);
+
+  // the selection hasnt loaded yet or is all outside so theres nothing to play
+  if(end <= start)
+    {
+      memset(output, 0, (size_t)frames * buffer.samples.elementSize);
+      if(keepStats && starved)
+	__atomic_fetch_add(&stats.starved, 1, __ATOMIC_RELAXED);
+      return position;
+    }
+
+  // start from inside the region
+  // going forwards from the end starts again unless its waiting for the loader
+  // and going backwards from outside starts at the last frame
+  if(step > 0 && position >= end && !starved)
+    position = start;
+  else if(step > 0 && position < start)
+    position = start;
+  else if(step < 0 && (position >= end || position < start))
+    position = end - 1;
+  int64_t cursor = ((int64_t)position << RATE_SHIFT) | transport.fraction;
+
+  int i = 0;
+  while(i < frames)
+    {
+      // gather as many frames as there is room for
+      // stopping early if playback runs out of the region
+      int count = min(frames - i, INTERPOLATE_SAMPLES / channels);
+      int j, c;
+      for(j = 0; j < count; j++)
+	{
+	  int64_t frame = cursor >> RATE_SHIFT;
+	  if(frame < start || frame >= end || frame < 0 || frame >= buffer.length) break;
+	  int weight = (cursor & ((1 << RATE_SHIFT) - 1)) >> (RATE_SHIFT - INTERPOLATE_SHIFT);
+	  const int16_t* here = sampleAt(buffer, frame);
+	  const int16_t* next = frame + 1 < min(end, buffer.length) ? sampleAt(buffer, frame + 1) : here;
+	  for(c = 0; c < channels; c++)
+	    {
+	      int k = (j * channels + c) * 2;
+	      pairs[k] = here[c];
+	      pairs[k + 1] = next[c];
+	      weights[k] = (1 << INTERPOLATE_SHIFT) - weight;
+	      weights[k + 1] = weight;
+	    }
+	  cursor += step;
+	}
+      kernels.interpolate(pairs, weights, j * channels, output + i * channels);
+      i += j;
+      if(j == count) continue;
+
+      // ran out of the region so wait, loop or stop just like at normal speed
+      int16_t* rest = output + i * channels;
+      size_t restBytes = (size_t)(frames - i) * buffer.samples.elementSize;
+      if(starved && step > 0)
+	{
+	  memset(rest, 0, restBytes);
+	  if(keepStats)
+	    __atomic_fetch_add(&stats.starved, 1, __ATOMIC_RELAXED);
+	  cursor = (int64_t)end << RATE_SHIFT;
+	  break;
+	}
+      else if(__atomic_load_n(&looping, __ATOMIC_ACQUIRE))
+	cursor = step > 0 ? (int64_t)start << RATE_SHIFT : ((int64_t)end << RATE_SHIFT) - 1;
+      else if(step > 0 && (nextBuffer = switchBuffers(selection)) != NULL)
+	{
+	  // straight on into the next file, keeping how far between frames it was
+	  buffer = *nextBuffer;
+	  cursor -= (int64_t)end << RATE_SHIFT;
+	  start = 0;
+	  end = buffer.length;
+	}
+      else
+	{
+	  __atomic_store_n(&playing, 0, __ATOMIC_RELEASE);
+	  __atomic_store_n(&transport.ended, 1, __ATOMIC_RELEASE);
+	  memset(rest, 0, restBytes);
+	  cursor = (int64_t)(step > 0 ? end : start) << RATE_SHIFT;
+	  break;
+	}
+    }
+
+  transport.fraction = cursor & ((1 << RATE_SHIFT) - 1);
+  return cursor >> RATE_SHIFT;
+}
+
+// sdl audio fetch callback for more audio
+// this runs on the audio thread so all it does is copy or interpolate samples
+// it only talks to the interface through atomics and never blocks or allocates
+void fillAudio(Uint8* stream, int remainingBytes)
+{
+  Uint64 started = startTiming();
+
+  // see how long it was since the last callback
+  // if its been longer than that buffer lasts then the device must have run dry
+  // this is always watched so the buffer can grow when it keeps happening
+  Uint64 now = started != 0 ? started : SDL_GetPerformanceCounter();
+  Uint64 last = __atomic_exchange_n(&stats.lastCallback, now, __ATOMIC_RELAXED);
+  if(last != 0)
+    {
+      if(started != 0)
+	addTiming(TIMING_AUDIO_INTERVAL, now - last);
+      if(now - last > stats.deadline * 3 / 2)
+	__atomic_fetch_add(&stats.underruns, 1, __ATOMIC_RELAXED);
+    }
+  if(__atomic_load_n(&playing, __ATOMIC_ACQUIRE))
+    {
+      // jump to wherever the interface asked for
+      int64_t position = __atomic_load_n(&transport.position, __ATOMIC_ACQUIRE);
+      if(__atomic_exchange_n(&transport.seekPending, 0, __ATOMIC_ACQ_REL))
+	position = __atomic_load_n(&transport.seekPosition, __ATOMIC_RELAXED);
+      // a fully loaded buffer from the playlist gets played instead of the loading one once its switched to
+      struct region selection = getSelection();
+      struct audioBuffer* playlistBuffer = __atomic_load_n(&transport.buffer, __ATOMIC_ACQUIRE);
+      int done = playlistBuffer != NULL || loadingDone();
+      struct audioBuffer buffer = playlistBuffer != NULL ? *playlistBuffer : loadedAudio();
+
+      // anything other than forwards at normal speed has to be interpolated
+      int offset = 0;
+      if(__atomic_load_n(&transport.rate, __ATOMIC_RELAXED) != 1 << RATE_SHIFT ||
+	 __atomic_load_n(&transport.reversed, __ATOMIC_RELAXED))
+	{
+	  position = playVarispeed(buffer, selection, done, position, (int16_t*)stream,
+				   remainingBytes / buffer.samples.elementSize, started != 0);
+	  remainingBytes = 0;
+	}
+      else
+	transport.fraction = 0;
+
+      // if playing, fill the provided buffer with audio to play
+      // copy regions of audio until the end of file or region
+      // then either stop or loop depending on looping status
+      while(remainingBytes > 0)
+	{
+	  int frameSize = buffer.samples.elementSize;
+	  int remainingSamples = remainingBytes / frameSize;
+	  int64_t loaded = buffer.length;
+	  // get the nearest stopping point
+	  int64_t end, start;
+	  if(selection.start != selection.stop)
+	    {
+	      end = max(selection.start,
+			selection.stop);
+	      start = min(selection.start,
+			  selection.stop);
+	    }
+	  else
+	    {
+	      end = loaded;
+	      start = 0;
+	    }
+	  // if the end hasnt been loaded yet
+	  // play what there is and wait for the rest
+	  int starved = 0;
+	  if(end >= loaded && !done)
+	    {
+	      end = loaded;
+	      starved = 1;
+	    }
+	  // the selection can reach outside the audio but only the audio gets played
+	  start = max(start, 0);
+	  end = min(end, loaded);
+	  if(end <= start)
+	    {
+	      // none of the selection has loaded, or it was all outside
+	      memset(stream + offset, 0, remainingBytes);
+	      if(started != 0 && starved)
+		__atomic_fetch_add(&stats.starved, 1, __ATOMIC_RELAXED);
+	      break;
+	    }
+	  // make sure the play position isnt greater than the end
+	  // or less than start
+	  if(position > end) position = end;
+	  if(position < start ||
+	     (position == end && !starved))
+	    position = start;
+	  int64_t distance = end - position;
+
+	  // only copy to the nearest stopping point
+	  int len;
+	  if(distance < remainingSamples)
+	    len = distance;
+	  else
+	    len = remainingSamples;
+	  int lenBytes = len * frameSize;
+
+	  // copy this portion
+	  copySamples(buffer, position, len,
+		      (int16_t*)(stream + offset));
+	  position += len;
+	  offset += lenBytes;
+	  remainingBytes -= lenBytes;
+
+	  // if theres some left over, see if loop is on
+	  if(remainingBytes > 0)
+	    {
+	      if(starved)
+		{
+		  // caught up with the loader
+		  // so fill the rest with silence until theres more
+		  memset(stream + offset, 0, remainingBytes);
+		  if(started != 0)
+		    __atomic_fetch_add(&stats.starved, 1, __ATOMIC_RELAXED);
+		  break;
+		}
+	      else if(__atomic_load_n(&looping, __ATOMIC_ACQUIRE))
+		{
+		  // loop back to begining of selection
+		  position = start;
+		}
+	      else if((playlistBuffer = switchBuffers(selection)) != NULL)
+		{
+		  // carry straight on into the next file of the playlist
+		  buffer = *playlistBuffer;
+		  done = 1;
+		  position = 0;
+		}
+	      else
+		{
+		  // looks like loop is off
+		  // meaning playback has got to end here. >:(
+		  // the interface will notice and pause the device
+		  __atomic_store_n(&playing, 0, __ATOMIC_RELEASE);
+		  __atomic_store_n(&transport.ended, 1, __ATOMIC_RELEASE);
+		  // and fill the rest with silecnc while ur at it
+		  memset(stream + offset, 0, remainingBytes);
+		  break; // <- very very important!! ><
+		}
+	    }
+	}
+
+      // let the interface know where playback got to
+      // unless it asked for a seek in the meantime
+      if(!__atomic_load_n(&transport.seekPending, __ATOMIC_ACQUIRE))
+	__atomic_store_n(&transport.position, position, __ATOMIC_RELEASE);
+    }
+  else
+    {
+      // if not playing, got to give sdl some silence
+      memset(stream, 0, remainingBytes);
+    }
+  stopTiming(TIMING_REQUEST_AUDIO, started);
+}
+
+// mix frames of one channel count into another
+// each output channel is the average of every input channel that lands on it going round
+// so mono goes to every speaker and extra channels fold into the ones there are
+void mixChannels(const int16_t* input, int inputChannels, int16_t* output, int outputChannels, int frames)
+{
+  int i, c, k;
+  for(i = 0; i < frames; i++)
+    {
+      for(c = 0; c < outputChannels; c++)
+	{
+	  int sum = 0, count = 0;
+	  for(k = c % inputChannels; k < inputChannels; k += outputChannels)
+	    {
+	      sum += input[k];
+	      count++;
+	    }
+	  output[c] = sum / count;
+	}
+      input += inputChannels;
+      output += outputChannels;
+    }
+}
+
+// give sdl what it asked for
+// mixed down or up first when the device doesnt have as many channels as the audio
+void requestAudio(void* userdata, Uint8* stream, int remainingBytes)
+{
+  if(deviceChannels == audioChannels)
+    {
+      fillAudio(stream, remainingBytes);
+      return;
+    }
+  int frames = remainingBytes / (deviceChannels * (int)sizeof(int16_t));
+  fillAudio((Uint8*)mixBuffer, frames * audioChannels * (int)sizeof(int16_t));
+  mixChannels(mixBuffer, audioChannels, (int16_t*)stream, deviceChannels, frames);
+}
+
+// open the audio device asking for some number of frames at a time
+// the device might give a different number, which is reported and used from then on
+// it gets to say what rate and format it really plays too
+// and if thats not what the audio is its opened again with sdl converting to it, which is reported as well
+// the channels are left to the device and mixed to whatever it has in the callback
+int openAudioDevice(int samples)
+{
+  SDL_AudioSpec want, have;
+
+  // desired audio out format
+  // the same as the audio was loaded with so nothing has to be converted while playing
+  SDL_memset(&want, 0, sizeof(want));
+  want.freq = audioBuffer.sampleRate;
+  want.format = audioBuffer.format;
+  want.channels = min(audioBuffer.channels, MAX_DEVICE_CHANNELS);
+  want.samples = samples;
+  want.callback = requestAudio;
+
+  audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_SAMPLES_CHANGE |
+				    SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_FORMAT_CHANGE |
+				    SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+  if(audioDevice != 0 && (have.freq != want.freq || have.format != want.format))
+    {
+      fprintf(stderr, "Audio device plays %d Hz, %d bit%s, SDL converts the audio to that\n", have.freq,
+	      SDL_AUDIO_BITSIZE(have.format), SDL_AUDIO_ISFLOAT(have.format) ? " float" : "");
+      SDL_CloseAudioDevice(audioDevice);
+      audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_SAMPLES_CHANGE |
+					SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+    }
+  if(audioDevice == 0)
+    {
+      fprintf(stderr, "Failed to open audio: %s\n", SDL_GetError());
+      return -1;
+    }
+  fprintf(stderr, "Audio: %d Hz, %d channels, %d frames a callback (%.1f ms)%s%s\n",
+	  have.freq, have.channels, have.samples, 1000.0 * have.samples / have.freq,
+	  have.samples != samples ? " instead of the asked for size" : "",
+	  have.channels != audioBuffer.channels ? ", mixed from the audio channels" : "");
+
+  // somewhere to put the audio before mixing it when the channels dont match
+  // the device isnt running yet so the callback cant be using the old one
+  deviceChannels = have.channels;
+  audioChannels = audioBuffer.channels;
+  free(mixBuffer);
+  mixBuffer = NULL;
+  if(deviceChannels != audioChannels)
+    {
+      mixBuffer = malloc((size_t)have.samples * audioChannels * sizeof(int16_t));
+      if(mixBuffer == NULL)
+	{
+	  fprintf(stderr, "Failed to allocate the channel mixing buffer\n");
+	  SDL_CloseAudioDevice(audioDevice);
+	  audioDevice = 0;
+	  return -1;
+	}
+    }
+
+  // how long each callback's worth of audio lasts
+  // for telling when the device ran dry
+  playBufferSize = have.samples;
+  stats.deadline = (Uint64)have.samples * SDL_GetPerformanceFrequency() / have.freq;
+  __atomic_store_n(&stats.lastCallback, 0, __ATOMIC_RELAXED);
+  adaptedUnderruns = __atomic_load_n(&stats.underruns, __ATOMIC_RELAXED);
+  adaptedTime = SDL_GetTicks();
+
+  // unpause and have it poll all it wants muahuahuahuahuah
+  SDL_PauseAudioDevice(audioDevice, !isPlaying());
+  return 0;
+}
+
+// grow the device buffer when callbacks keep coming too late for it
+// small buffers make seeking feel instant but not every system can keep up with them
+// closing the device waits for the callback so playback just carries on from the transport
+void adaptPlayBuffer()
+{
+  if(cliArgs.bufferSize != 0 || cliArgs.replayTrace != NULL) return;
+  Uint32 now = SDL_GetTicks();
+  if(now - adaptedTime < ADAPT_INTERVAL) return;
+  Uint64 underruns = __atomic_load_n(&stats.underruns, __ATOMIC_RELAXED);
+  if(underruns - adaptedUnderruns >= ADAPT_UNDERRUNS && playBufferSize < MAX_PLAY_BUFFER_SIZE)
+    {
+      int size = playBufferSize;
+      SDL_CloseAudioDevice(audioDevice);
+      if(openAudioDevice(min(size * 2, MAX_PLAY_BUFFER_SIZE)) == 0) return;
+      // go back to what worked before if the bigger one wont open
+      if(openAudioDevice(size) == 0) return;
+      __atomic_store_n(&playing, 0, __ATOMIC_RELEASE);
+      updateWindowTitle();
+    }
+  adaptedUnderruns = underruns;
+  adaptedTime = now;
+}
+
+// see which modifiers are currently held down
+struct modifiers getModifiers()
+{
+  // a replayed trace says what was held instead
+  if(cliArgs.replayTrace != NULL)
+    return replayModifiers;
+
+  const Uint8* state = SDL_GetKeyboardState(NULL);
+  struct modifiers modifiers = { state[SDL_SCANCODE_LCTRL] ||
+				 state[SDL_SCANCODE_RCTRL],
+				 state[SDL_SCANCODE_LALT] ||
+				 state[SDL_SCANCODE_RALT],
+				 state[SDL_SCANCODE_LSHIFT] ||
+				 state[SDL_SCANCODE_LSHIFT]};
+  return modifiers;
+}
+
+// get the final target of an abstract user event
+enum target getFinalTarget(enum target target)
+{
+  // let the target be overridable by modifiers
+  struct modifiers modifiers = getModifiers();
+  if(modifiers.ctrl && modifiers.alt)
+    return PLAY;
+  else if(modifiers.ctrl && !modifiers.alt)
+    return REGION;
+  else if(!modifiers.ctrl && modifiers.alt)
+    return VIEWPORT;
+  // other wise it stays unchanged
+  else return target;
+}
+
+// get the values of an abstract user input target
+struct targetValues getTargetValues(enum target target)
+{
+  // the return values will go in here
+  struct targetValues values = { 0, 0 };
+
+  // get the values for the given input target
+  switch(target)
+    {
+    case PLAY:
+      // get the audio cursor position
+      values.primary = getPlayPosition();
+      values.secondary = getPlayPosition();
+      break;
+    case REGION:
+      // get the selected region of audio
+      values.primary = selection.start;
+      values.secondary = selection.stop;
+      break;
+    case VIEWPORT:
+      // get the viewport region
+      values.primary = viewport.start;
+      values.secondary = viewport.stop;
+      break;
+    }
+  
+  // return the values
+  return values;
+}
+
+// get either primary or secondary value of target
+int64_t getTargetValue(enum target target, enum action which)
+{
+  // get whichever one it is
+  switch(which)
+    {
+    case PRIMARY:
+      return getTargetValues(target).primary;
+    case SECONDARY:
+      return getTargetValues(target).secondary;
+    }
+}
+
+// set the values of an abstract user input target
+void setTargetValues(enum target target, struct targetValues values)
+{
+  Uint64 started = startTiming();
+  switch(target)
+    {
+    case PLAY:
+      // set the audio cursor position
+      seek(values.primary);
+      break;
+    case REGION:
+      // set the selected region of audio
+      // kept to the audio so playing and exporting it never reads outside
+      __atomic_store_n(&selection.start, clampToAudio(values.primary), __ATOMIC_RELEASE);
+      __atomic_store_n(&selection.stop, clampToAudio(values.secondary), __ATOMIC_RELEASE);
+      break;
+    case VIEWPORT:
+      // set the viewport region
+      viewport.start = values.primary;
+      viewport.stop = values.secondary;
+      break;
+    }
+  
+  // show the changes on the screen next frame
+  requestRedraw();
+  stopTiming(TIMING_SET_TARGET, started);
+}
+
+// set specifically the primary value of a target
+void setTargetPrimaryValue(enum target target, int64_t value)
+{
+  struct targetValues old = getTargetValues(target);
+  struct targetValues new = { value, old.secondary };
+  setTargetValues(target, new);
+}
+
+// set specifically the secondary value of a target
+void setTargetSecondaryValue(enum target target, int64_t value)
+{
+  struct targetValues old = getTargetValues(target);
+  struct targetValues new = { old.primary, value };
+  setTargetValues(target, new);
+}
+
+// set both values of a target the same
+void setTargetBothValues(enum target target, int64_t value)
+{
+  struct targetValues new = { value, value };
+  setTargetValues(target, new);
+}
+
+// set either primary or secondary value of target
+void setTargetValue(enum target target, int64_t value, enum action which)
+{
+  // set whichever one it is
+  switch(which)
+    {
+    case PRIMARY:
+      setTargetPrimaryValue(target, value);
+      break;
+    case SECONDARY:
+      setTargetSecondaryValue(target, value);
+      break;
+    }
+}
+
+// set both values but separate
+void setTargetPrimaryAndSecondaryValues(enum target target, int64_t primary, int64_t secondary)
+{
+  struct targetValues new = { primary, secondary };
+  setTargetValues(target, new);
+}
+
+// get the sample index at a pixel position
+int64_t pixelCoordinateToSample(int x)
+{
+  // get pixel coordinates
+  int width = mainSurface->w;
+
+  // the same sample the column gets drawn from
+  return columnSample(viewport, width, x);
+}
+
+// get the pixel position of a sample
+int sampleToPixelCoordinate(int64_t position)
+{
+  // get pixel coordinates
+  int width = mainSurface->w;
+
+  // viewport stuff
+  int64_t viewportStartSample = viewport.start;
+  int64_t viewportEndSample = viewport.stop;
+  int64_t sampleRange = viewportEndSample - viewportStartSample;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  // far off screen still has to fit in an int
+  double pixel = position / samplesPerPixel - firstColumn(viewport, width);
+  int pixelPosition = max(-(double)INT_MAX, min((double)INT_MAX, pixel));
+
+  // return the pixel position
+  return pixelPosition;
+}
+
+// get the sample index at the mouse position
+int64_t getMouseSamplePosition(SDL_Event event)
+{
+  return pixelCoordinateToSample(event.motion.x);
+}
+
+enum action getNearestSelectionPole(int64_t position)
+{
+  // get the distances between both poles
+  int64_t primaryDelta = llabs(selection.start - position);
+  int64_t secondaryDelta = llabs(selection.stop - position);
+
+  // return whichever is closest
+  if(primaryDelta < secondaryDelta)
+    return PRIMARY;
+  else return SECONDARY;
+}
+
+// initiate a region selection
+void initiateSelection(int64_t position)
+{
+  position = clampToAudio(position);
+
+  // if shift is held then modify existing selection
+  struct modifiers modifiers = getModifiers();
+  if(modifiers.shift)
+    {
+      // grab the nearest pole
+      selectionGrabbedPole = getNearestSelectionPole(position);
+
+      // get the pixel position of that pole
+      int64_t pole = getTargetValue(REGION, selectionGrabbedPole);
+      int pixelPosition = sampleToPixelCoordinate(pole);
+
+      // warp the mouse to the pole
+      SDL_WarpMouseInWindow(mainWindow, pixelPosition, mainSurface->h / 2);
+    }
+  // otherwise grab the nearest pole
+  else
+    {
+      // clear the selection
+      setTargetBothValues(REGION, position);
+
+      // grab the secondary pole
+      selectionGrabbedPole = SECONDARY;
+    }
+}
+
+// continue a region selection
+void continueSelection(int64_t position)
+{
+  // set the position of whichever selection pole is grabbed
+  setTargetValue(REGION, position, selectionGrabbedPole);
+}
+
+// unselect anything
+void cancelSelection()
+{
+  setTargetBothValues(REGION, 0);
+}
+
+// general zoom the viewport
+void zoom(int64_t origin, double amount)
+{
+  // calculate scale factor from zoom amount
+  double scale = pow(2, amount);
+
+  // get the distance the origin is from both ends of the viewport
+  int64_t startDelta = viewport.start - origin;
+  int64_t stopDelta = viewport.stop - origin;
+
+  // scale those distances
+  startDelta /= scale;
+  stopDelta /= scale;
+
+  // set the new viewport
+  setTargetPrimaryAndSecondaryValues(VIEWPORT,
+				     origin + startDelta,
+				     origin + stopDelta);
+}
+
+// general pan the viewport
+void pan(int delta)
+{
+  // get pixel coordinates
+  int width = mainSurface->w;
+
+  // viewport stuff
+  int64_t viewportStartSample = viewport.start;
+  int64_t viewportEndSample = viewport.stop;
+  int64_t sampleRange = viewportEndSample - viewportStartSample;
+  double samplesPerPixel = 1.0 * sampleRange / width;
+  int64_t deltaSamples = delta * samplesPerPixel;
+
+  // set the new viewport
+  setTargetPrimaryAndSecondaryValues(VIEWPORT,
+				     viewport.start - deltaSamples,
+				     viewport.stop - deltaSamples);
+}
+
+// pan the viewport with mouse drag
+void dragViewport(SDL_Event event)
+{
+  pan(event.motion.xrel);
+}
+
+// deal with mouse drags
+void mouseDrag(SDL_Event event, enum target target)
+{
+  // override with modifiers
+  target = getFinalTarget(target);
+
+  // do different things depending on the target
+  switch(target)
+    {
+    case PLAY:
+      // set the player position
+      setTargetPrimaryValue(target, getMouseSamplePosition(event));
+      break;
+    case REGION:
+      // continue a selection
+      continueSelection(getMouseSamplePosition(event));
+      break;
+    case VIEWPORT:
+      dragViewport(event);
+      break;
+    }
+}
+
+// handle window events
+int handleWindowEvent(SDL_Event event)
+{
+  switch(event.window.event)
+    {
+    case SDL_WINDOWEVENT_SIZE_CHANGED:
+      // get the new surface
+      // the audio callback never draws so this is safe while playing
+      mainSurface = SDL_GetWindowSurface(mainWindow);
+      damageWindow();
+      requestRedraw();
+      break;
+    case SDL_WINDOWEVENT_EXPOSED:
+      // whatever was on the screen got lost so put all of it back
+      damageWindow();
+      requestRedraw();
+      break;
+    }
+
+  // return 0 to mean no quit
+  return 0;
+}
+
+// handle key events
+int handleKeyboardEvent(SDL_Event event)
+{
+  // ignure key ups
+  if(event.key.type == SDL_KEYDOWN)
+    {
+      // key events are all position by default
+      enum target target = getFinalTarget(PLAY);
+      
+      // get pixel coordinates
+      int width = mainSurface->w;
+
+      // viewport stuff
+      int64_t viewportStartSample = viewport.start;
+      int64_t viewportEndSample = viewport.stop;
+      int64_t sampleRange = viewportEndSample - viewportStartSample;
+      double samplesPerPixel = 1.0 * sampleRange / width;
+      int64_t step = KEY_STEP_SCALE * samplesPerPixel;
+      
+      // which physical key?
+      // arrow keys
+      switch(target)
+	{
+	case PLAY:
+	case REGION:
+	  switch(event.key.keysym.scancode)
+	    {
+	    case SDL_SCANCODE_RIGHT:
+	      setTargetPrimaryValue(target, getTargetValues(target).primary + step);
+	      break;
+	    case SDL_SCANCODE_LEFT:
+	      setTargetPrimaryValue(target, getTargetValues(target).primary - step);
+	      break;
+	    case SDL_SCANCODE_DOWN:
+	      setTargetSecondaryValue(target, getTargetValues(target).secondary - step);
+	      break;
+	    case SDL_SCANCODE_UP:
+	      setTargetSecondaryValue(target, getTargetValues(target).secondary + step);
+	      break;
+	    }
+	  break;
+	case VIEWPORT:
+	  switch(event.key.keysym.scancode)
+	    {
+	    case SDL_SCANCODE_UP:
+	      zoom(pixelCoordinateToSample(mainSurface->w / 2),
+		   KEY_ZOOM_SCALE);
+	      break;
+	    case SDL_SCANCODE_DOWN:
+	      zoom(pixelCoordinateToSample(mainSurface->w / 2),
+		   -KEY_ZOOM_SCALE);
+	      break;
+	    case SDL_SCANCODE_LEFT:
+	      pan(KEY_PAN_SCALE);
+	      break;
+	    case SDL_SCANCODE_RIGHT:
+	      pan(-KEY_PAN_SCALE);
+	      break;
+	    }
+	  break;
+	}
+      
+      // now which virtual key?
+      // these are for mnemonic hotkeys
+      switch(event.key.keysym.sym)
+	{
+	case SDLK_SPACE:
+	  // play pause key
+	  togglePlaying();
+	  break;
+	case SDLK_l:
+	  // toggle looping
+	  toggleLooping();
+	  break;
+	case SDLK_e:
+	  // export selected snippet
+	  exportSnippet();
+	  break;
+	case SDLK_i:
+	  // show or hide the stats
+	  toggleStats();
+	  break;
+	case SDLK_f:
+	  // waveform or spectrogram
+	  toggleSpectrogram();
+	  break;
+	case SDLK_r:
+	  // play backwards or forwards
+	  toggleReversed();
+	  break;
+	case SDLK_LEFTBRACKET:
+	  // slow down by a semitone, or a tenth of one with shift
+	  changePlaybackRate(getModifiers().shift ? -0.1 : -1);
+	  break;
+	case SDLK_RIGHTBRACKET:
+	  // speed up
+	  changePlaybackRate(getModifiers().shift ? 0.1 : 1);
+	  break;
+	case SDLK_BACKSLASH:
+	  // back to normal speed
+	  setPlaybackRate(1);
+	  break;
+	case SDLK_n:
+	  // next file of the playlist
+	  skipTrack(1, isPlaying());
+	  break;
+	case SDLK_p:
+	  // previous file
+	  skipTrack(-1, isPlaying());
+	  break;
+	case SDLK_ESCAPE:
+	case SDLK_q:
+	  // quit
+	  return -1;
+	  break;
+	}
     }
 
   // return 0 to mean no quit
   return 0;
 }
 
-// handle key events
-int handleKeyboardEvent(SDL_Event event)
+// handle mouse move events
+int handleMouseMotionEvent(SDL_Event event)
+{
+  // this is for dragging events really
+  // so make appropriate mouse drag events out of this
+  int state = event.motion.state;
+  if(state & SDL_BUTTON_LMASK)
+    mouseDrag(event, PLAY);
+  if(state & SDL_BUTTON_RMASK)
+    mouseDrag(event, REGION);
+  if(state & SDL_BUTTON_MMASK)
+    mouseDrag(event, VIEWPORT);
+  
+  // return 0 for no quit event
+  return 0;
+}
+
+// handle mouse button events
+int handleMouseButtonEvent(SDL_Event event)
+{
+  // ignore mouse ups
+  if(event.button.state == SDL_PRESSED)
+    {
+      // first set the target of the action by which button
+      enum target target;
+      switch(event.button.button)
+	{
+	case SDL_BUTTON_LEFT:
+	  target = PLAY;
+	  break;
+	case SDL_BUTTON_RIGHT:
+	  target = REGION;
+	  break;
+	case SDL_BUTTON_MIDDLE:
+	  target = VIEWPORT;
+	  break;
+	}
+
+      // and then let it be modified with modifiers
+      target = getFinalTarget(target);
+      // do different things depending on the target
+      switch(target)
+	{
+	case PLAY:
+	  // set the play position
+	  setTargetPrimaryValue(target, getMouseSamplePosition(event));
+	  // grab mouse cursor
+	  SDL_SetRelativeMouseMode(1);
+	  break;
+	case REGION:
+	  // initiate a selection
+	  initiateSelection(getMouseSamplePosition(event));
+	  break;
+	case VIEWPORT:
+	  // grab mouse cursor
+	  SDL_SetRelativeMouseMode(1);
+	  break;
+	}
+    }
+  else
+    {
+      // release mouse cursor
+      SDL_SetRelativeMouseMode(0);
+    }
+  
+  // return 0 for no quit event
+  return 0;
+}
+
+// get where the mouse is across the window
+int getMouseX()
+{
+  // a replayed trace says where it was instead
+  if(cliArgs.replayTrace != NULL)
+    return replayMouseX;
+
+  int x;
+  SDL_GetMouseState(&x, NULL);
+  return x;
+}
+
+// handle mouse wheel events
+int handleMouseWheelEvent(SDL_Event event)
+{
+  // mouse wheel is viewport by default
+  enum target target = getFinalTarget(VIEWPORT);
+
+  // do a general pan for how much was scrolled horizontally
+  pan(event.wheel.x * SCROLL_PAN_SCALE);
+  
+  // and a general zoom for how much was scrolled vertically
+  zoom(pixelCoordinateToSample(getMouseX()), event.wheel.y * SCROLL_ZOOM_SCALE);
+  
+  // return 0 for no quit event
+  return 0;
+}
+
+// handle the loader getting further along
+int handleLoadProgressEvent(SDL_Event event)
+{
+  // keep showing the whole file if thats what was being shown
+  if(viewport.start == 0 && viewport.stop == wholeLength)
+    viewport.stop = expectedLength();
+  wholeLength = expectedLength();
+
+  // show the new samples and how far along it is
+  updateWindowTitle();
+  requestRedraw();
+
+  // return 0 for no quit event
+  return 0;
+}
+
+// handle a spectrogram tile being ready
+// the columns showing it need drawing again
+int handleSpectrumEvent(SDL_Event event)
+{
+  int level = event.user.code;
+  int64_t start = (int64_t)(uintptr_t)event.user.data1 | (int64_t)(uintptr_t)event.user.data2 << 32;
+  if(showSpectrogram)
+    {
+      damageSamples(start, start + ((int64_t)SPECTRUM_TILE_COLUMNS << level));
+      requestRedraw();
+    }
+
+  // return 0 for no quit event
+  return 0;
+}
+
+// handle an export moving along or finishing
+int handleExportProgressEvent(SDL_Event event)
+{
+  // make way for the next exports
+  reapExports();
+  startExports();
+  updateWindowTitle();
+
+  // return 0 for no quit event
+  return 0;
+}
+
+// write an event to the trace being recorded
+// one line each with the time, the modifiers held, where the mouse is
+// and whatever the handlers look at for that kind of event
+void recordEvent(SDL_Event event)
+{
+  struct modifiers modifiers = getModifiers();
+  fprintf(traceFile, "%u %d%d%d %d ", SDL_GetTicks() - traceStart,
+	  modifiers.ctrl, modifiers.alt, modifiers.shift, getMouseX());
+  switch(event.type)
+    {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      fprintf(traceFile, "key %u %d %d %d\n", event.type, event.key.keysym.scancode,
+	      event.key.keysym.sym, event.key.repeat);
+      break;
+    case SDL_MOUSEMOTION:
+      fprintf(traceFile, "motion %d %d %d %d %u\n", event.motion.x, event.motion.y,
+	      event.motion.xrel, event.motion.yrel, event.motion.state);
+      break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      fprintf(traceFile, "button %u %d %d %d %d %d\n", event.type, event.button.button,
+	      event.button.state, event.button.clicks, event.button.x, event.button.y);
+      break;
+    case SDL_MOUSEWHEEL:
+      fprintf(traceFile, "wheel %d %d\n", event.wheel.x, event.wheel.y);
+      break;
+    case SDL_WINDOWEVENT:
+      fprintf(traceFile, "window %d %d %d\n", event.window.event,
+	      event.window.data1, event.window.data2);
+      break;
+    case SDL_QUIT:
+      fprintf(traceFile, "quit\n");
+      break;
+    default:
+      // nothing else gets handled so theres no point keeping it
+      fprintf(traceFile, "none\n");
+      break;
+    }
+}
+
+// read the next event from the trace being replayed
+// returns non-zero at the end of the trace
+int readTraceEvent(SDL_Event* event, Uint32* time)
+{
+  char line[256];
+  char kind[16];
+  int ctrl, alt, shift, offset;
+  SDL_memset(event, 0, sizeof(SDL_Event));
+  while(fgets(line, sizeof(line), traceFile) != NULL)
+    {
+      if(sscanf(line, "%u %1d%1d%1d %d %15s %n", time, &ctrl, &alt, &shift,
+		&replayMouseX, kind, &offset) != 6)
+	continue;
+      struct modifiers modifiers = { ctrl, alt, shift };
+      replayModifiers = modifiers;
+      const char* fields = line + offset;
+      unsigned type, state;
+      int a, b, c, d, e;
+      if(strcmp(kind, "key") == 0 &&
+	 sscanf(fields, "%u %d %d %d", &type, &a, &b, &c) == 4)
+	{
+	  event->type = type;
+	  event->key.state = type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+	  event->key.keysym.scancode = a;
+	  event->key.keysym.sym = b;
+	  event->key.repeat = c;
+	}
+      else if(strcmp(kind, "motion") == 0 &&
+	      sscanf(fields, "%d %d %d %d %u", &a, &b, &c, &d, &state) == 5)
+	{
+	  event->type = SDL_MOUSEMOTION;
+	  event->motion.x = a;
+	  event->motion.y = b;
+	  event->motion.xrel = c;
+	  event->motion.yrel = d;
+	  event->motion.state = state;
+	}
+      else if(strcmp(kind, "button") == 0 &&
+	      sscanf(fields, "%u %d %d %d %d %d", &type, &a, &b, &c, &d, &e) == 6)
+	{
+	  event->type = type;
+	  event->button.button = a;
+	  event->button.state = b;
+	  event->button.clicks = c;
+	  event->button.x = d;
+	  event->button.y = e;
+	}
+      else if(strcmp(kind, "wheel") == 0 &&
+	      sscanf(fields, "%d %d", &a, &b) == 2)
+	{
+	  event->type = SDL_MOUSEWHEEL;
+	  event->wheel.x = a;
+	  event->wheel.y = b;
+	}
+      else if(strcmp(kind, "window") == 0 &&
+	      sscanf(fields, "%d %d %d", &a, &b, &c) == 3)
+	{
+	  event->type = SDL_WINDOWEVENT;
+	  event->window.event = a;
+	  event->window.data1 = b;
+	  event->window.data2 = c;
+	}
+      else if(strcmp(kind, "quit") == 0)
+	event->type = SDL_QUIT;
+      else
+	continue;
+      return 0;
+    }
+  return -1;
+}
+
+// which timing an event is counted under
+enum timingKind eventTiming(SDL_Event event)
+{
+  if(event.type == loadProgressEvent || event.type == exportProgressEvent)
+    return TIMING_LOAD_EVENT;
+  switch(event.type)
+    {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      return TIMING_KEY_EVENT;
+    case SDL_MOUSEMOTION:
+      return TIMING_MOTION_EVENT;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      return TIMING_BUTTON_EVENT;
+    case SDL_MOUSEWHEEL:
+      return TIMING_WHEEL_EVENT;
+    default:
+      return TIMING_WINDOW_EVENT;
+    }
+}
+
+// process an SDL event
+int processEvent(SDL_Event event)
+{
+  // keep a record of it if asked to
+  // the loader's, exports' and spectrogram's events just come from them so they dont go in
+  if(cliArgs.recordTrace != NULL && traceFile != NULL && event.type != loadProgressEvent
+     && event.type != exportProgressEvent && event.type != spectrumEvent)
+    recordEvent(event);
+
+  // the loader's and exports' events arent known until runtime
+  if(event.type == loadProgressEvent)
+    return handleLoadProgressEvent(event);
+  if(event.type == exportProgressEvent)
+    return handleExportProgressEvent(event);
+  if(event.type == spectrumEvent)
+    return handleSpectrumEvent(event);
+
+  switch(event.type)
+    {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      return handleKeyboardEvent(event);
+    case SDL_MOUSEMOTION:
+      return handleMouseMotionEvent(event);
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+      return handleMouseButtonEvent(event);
+    case SDL_MOUSEWHEEL:
+      return handleMouseWheelEvent(event);
+    case SDL_WINDOWEVENT:
+      return handleWindowEvent(event);
+    case SDL_QUIT:
+      // return non-zero to mean exit
+      return -1;
+    }
+  // return 0 for no quit event
+  return 0;
+}
+
+// process an event and time how long it took
+int processTimedEvent(SDL_Event event)
+{
+  Uint64 started = startTiming();
+  int quit = processEvent(event);
+  if(started != 0)
+    {
+      stopTiming(eventTiming(event), started);
+      stats.events++;
+    }
+  return quit;
+}
+
+// merge an event into the one before it if they can be handled as one
+// returns non-zero if it was merged
+int mergeEvents(SDL_Event* event, SDL_Event next)
+{
+  // motion with the same buttons held only needs the latest position
+  // but the relative motion has to add up for dragging the viewport
+  if(event->type == SDL_MOUSEMOTION && next.type == SDL_MOUSEMOTION &&
+     event->motion.state == next.motion.state)
+    {
+      int xrel = event->motion.xrel + next.motion.xrel;
+      int yrel = event->motion.yrel + next.motion.yrel;
+      event->motion = next.motion;
+      event->motion.xrel = xrel;
+      event->motion.yrel = yrel;
+      return 1;
+    }
+
+  // scrolling just adds up
+  if(event->type == SDL_MOUSEWHEEL && next.type == SDL_MOUSEWHEEL &&
+     event->wheel.direction == next.wheel.direction)
+    {
+      event->wheel.x += next.wheel.x;
+      event->wheel.y += next.wheel.y;
+      return 1;
+    }
+  return 0;
+}
+
+// process an event along with every other event already waiting behind it
+// runs of motion and wheel events get merged so a fast mouse cant queue up
+// more work than the screen can show
+// returns non-zero if one of them was a quit event
+int processEvents(SDL_Event event)
+{
+  // only take what's already queued so a constant stream of events cant hold up the frame
+  SDL_Event next;
+  SDL_PumpEvents();
+  while(SDL_PeepEvents(&next, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
+    {
+      if(mergeEvents(&event, next)) continue;
+      if(processTimedEvent(event)) return -1;
+      event = next;
+    }
+  return processTimedEvent(event);
+}
+
+// note that a chunk of the samples is wanted right now
+// the kernel gets asked to read it in if the pager doesnt think its resident
+void wantChunk(int64_t chunk, int advice)
+{
+  if(chunk < 0 || chunk >= pager.loaded) return;
+  if(pager.wanted[chunk] == 0)
+    {
+      pager.resident++;
+      if(advice) adviseChunk(audioBuffer.samples, chunk, advice);
+    }
+  pager.wanted[chunk] = pager.clock;
+}
+
+// which power of two bucket how long ago a chunk was wanted falls in
+// chunks wanted this update are in bucket 0
+int chunkAge(int64_t chunk)
+{
+  Uint32 age = pager.clock - pager.wanted[chunk];
+  return age ? 32 - __builtin_clz(age) : 0;
+}
+
+// let go of the chunks wanted longest ago until there's some room under the budget
+// ages are bucketed by powers of two so finding the cutoff is one pass and dropping is another
+// nothing wanted by this update gets dropped even if that leaves it over
+void evictChunks()
+{
+  int64_t counts[33] = { 0 };
+  int64_t i;
+  for(i = 0; i < pager.loaded; i++)
+    if(pager.wanted[i] != 0)
+      counts[chunkAge(i)]++;
+
+  // find the youngest bucket that has to go, and how many from it
+  int64_t excess = pager.resident - pager.budget * 7 / 8;
+  int cutoff;
+  for(cutoff = 32; cutoff > 1 && excess > counts[cutoff]; cutoff--)
+    excess -= counts[cutoff];
+  excess = min(excess, counts[cutoff]);
+
+  for(i = 0; i < pager.loaded; i++)
+    {
+      if(pager.wanted[i] == 0) continue;
+      int bucket = chunkAge(i);
+      if(bucket < cutoff || bucket == 0 || (bucket == cutoff && excess-- <= 0)) continue;
+      adviseChunk(audioBuffer.samples, i, MADV_DONTNEED);
+      pager.wanted[i] = 0;
+      pager.resident--;
+    }
+}
+
+// keep the samples in memory to around the budget when they're in a file
+// whats around the playhead and on the screen is asked for ahead of time
+// and the rest gets dropped once too much is resident
+void updatePaging()
+{
+  struct chunkedArray samples = audioBuffer.samples;
+  if(!chunkedArrayPaged(samples)) return;
+  size_t chunkSize = (size_t)samples.elementSize << samples.shift;
+  if(pager.wanted == NULL)
+    {
+      pager.size = 0;
+      pager.budget = max(memoryBudget() / chunkSize, PAGE_PREFETCH * 4);
+      pager.resident = 0;
+      pager.loaded = 0;
+      pager.clock = 0;
+    }
+  pager.clock++;
+
+  // whatever the loader went through since last time was just written so its resident
+  // theres room made for it first, doubling so it doesnt get moved every time
+  int64_t loaded = loadedLength(&audioBuffer) >> samples.shift;
+  if(loaded > pager.size)
+    {
+      int64_t size = max(loaded, pager.size * 2);
+      Uint32* wanted = (Uint32*)realloc(pager.wanted, size * sizeof(Uint32));
+      if(wanted == NULL) return;
+      memset(wanted + pager.size, 0, (size - pager.size) * sizeof(Uint32));
+      pager.wanted = wanted;
+      pager.size = size;
+    }
+  while(pager.loaded < loaded)
+    {
+      pager.loaded++;
+      wantChunk(pager.loaded - 1, 0);
+    }
+
+  // the next few chunks in whichever direction its playing
+  // and wherever its going to wrap around to
+  int direction = transport.reversed ? -1 : 1;
+  int64_t playing = getPlayPosition() >> samples.shift;
+  int i;
+  for(i = 0; i <= PAGE_PREFETCH; i++)
+    wantChunk(playing + i * direction, MADV_WILLNEED);
+  struct region selection = getSelection();
+  if(selection.start < selection.stop)
+    wantChunk((transport.reversed ? selection.stop - 1 : selection.start) >> samples.shift, MADV_WILLNEED);
+
+  // the viewport when its close enough in to be drawing samples
+  // otherwise its mostly the summary that gets drawn, with the samples only read at the edges of the columns
+  int64_t first = viewport.start >> samples.shift;
+  int64_t last = (viewport.stop - 1) >> samples.shift;
+  int width = mainSurface->w;
+  int64_t chunk;
+  if(last - first < 2 * width)
+    for(chunk = first; chunk <= last; chunk++)
+      wantChunk(chunk, MADV_WILLNEED);
+  else
+    for(i = 0; i <= width; i++)
+      wantChunk(pixelCoordinateToSample(i) >> samples.shift, MADV_WILLNEED);
+
+  if(pager.resident > pager.budget)
+    evictChunks();
+}
+
+// replay the events of a trace at the times they were recorded
+// playback and loading carry on in between just like they would have
+void replayLoop()
+{
+  SDL_Event event;
+
+  // let loading finish first so every replay sees the same audio
+  while(!loadingDone())
+    {
+      while(SDL_PollEvent(&event))
+	processTimedEvent(event);
+      SDL_Delay(1);
+    }
+  while(SDL_PollEvent(&event))
+    processTimedEvent(event);
+  redrawScreen();
+
+  // then go through the trace
+  traceStart = SDL_GetTicks();
+  Uint32 time;
+  int events = 0;
+  while(!readTraceEvent(&event, &time))
+    {
+      // animate the playhead and take any other events until its time for this one
+      while(1)
+	{
+	  updatePlayback();
+	  SDL_Event pending;
+	  while(SDL_PollEvent(&pending))
+	    processTimedEvent(pending);
+	  presentFrame();
+	  Sint32 remaining = traceStart + time - SDL_GetTicks();
+	  if(remaining <= 0) break;
+	  SDL_Delay(min(remaining, frameInterval));
+	}
+      updatePlayback();
+      presentFrame();
+
+      // the window only really changes size when the trace says so
+      if(event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+	SDL_SetWindowSize(mainWindow, event.window.data1, event.window.data2);
+      events++;
+      if(processTimedEvent(event)) break;
+    }
+  if(redrawRequested)
+    redrawScreen();
+  printf("replayed %d events in %.3f s\n", events, (SDL_GetTicks() - traceStart) / 1000.0);
+}
+
+// print how long everything took while replaying
+void reportTimings()
+{
+  double milliseconds = 1000.0 / SDL_GetPerformanceFrequency();
+  printf("%-16s %8s %10s %10s %10s %10s\n", "what", "count", "total ms", "mean ms", "min ms", "max ms");
+  int i;
+  for(i = 0; i < TIMING_KINDS; i++)
+    {
+      struct timing timing = timings[i];
+      if(timing.count == 0) continue;
+      printf("%-16s %8llu %10.3f %10.4f %10.4f %10.4f\n", timingNames[i],
+	     (unsigned long long)timing.count,
+	     timing.total * milliseconds,
+	     timing.total * milliseconds / timing.count,
+	     timing.min * milliseconds,
+	     timing.max * milliseconds);
+    }
+}
+
+// ask ffprobe about the first audio stream of a file
+// anything it cant tell is left as mono 44100hz of unknown length
+struct audioInfo probeAudio(const char* filename)
+{
+  struct audioInfo info = { 1, 44100, 0 };
+  char* args[] = { "ffprobe", "-v", "quiet", "-select_streams", "a:0",
+		   "-show_entries", "stream=channels,sample_rate:format=duration",
+		   "-of", "default=noprint_wrappers=1", (char*)filename, NULL };
+  pid_t process;
+  FILE* pipe = openProcess(args, 0, &process);
+  if(pipe == NULL) return info;
+
+  // it prints a key=value line for each thing asked for
+  char line[256];
+  while(fgets(line, sizeof(line), pipe) != NULL)
+    {
+      int channels, sampleRate;
+      double duration;
+      if(sscanf(line, "channels=%d", &channels) == 1 && channels > 0)
+	info.channels = channels;
+      else if(sscanf(line, "sample_rate=%d", &sampleRate) == 1 && sampleRate > 0)
+	info.sampleRate = sampleRate;
+      else if(sscanf(line, "duration=%lf", &duration) == 1 && duration > 0)
+	info.duration = duration;
+    }
+  closeProcess(pipe, process);
+  return info;
+}
+
+// get the directory decoded audio is cached in, creating it if needed
+// returns non-zero if there isnt one
+int cacheDirectory(char* path, size_t size)
+{
+  const char* base = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if(base != NULL && base[0] != '\0')
+    snprintf(path, size, "%s", base);
+  else if(home != NULL)
+    snprintf(path, size, "%s/.cache", home);
+  else return -1;
+  mkdir(path, 0755);
+
+  // wavy gets its own directory in there
+  strncat(path, "/wavy", size - strlen(path) - 1);
+  mkdir(path, 0755);
+  struct stat info;
+  return stat(path, &info) || !S_ISDIR(info.st_mode);
+}
+
+// the names of the encodings a headerless file can be read as
+struct
+{
+  const char* name;
+  enum sampleEncoding encoding;
+  int bigEndian;
+} pcmEncodings[] =
+  {
+    { "u8", ENCODING_U8, 0 }, { "s8", ENCODING_S8, 0 },
+    { "s16le", ENCODING_S16, 0 }, { "s16be", ENCODING_S16, 1 },
+    { "s24le", ENCODING_S24, 0 }, { "s24be", ENCODING_S24, 1 },
+    { "s32le", ENCODING_S32, 0 }, { "s32be", ENCODING_S32, 1 },
+    { "f32le", ENCODING_F32, 0 }, { "f32be", ENCODING_F32, 1 },
+    { "f64le", ENCODING_F64, 0 }, { "f64be", ENCODING_F64, 1 }
+  };
+#define PCM_ENCODINGS (sizeof(pcmEncodings) / sizeof(pcmEncodings[0]))
+
+// how many bytes each sample of an encoding takes
+int bytesPerSample(enum sampleEncoding encoding)
+{
+  switch(encoding)
+    {
+    case ENCODING_U8:
+    case ENCODING_S8:
+      return 1;
+    case ENCODING_S16:
+      return 2;
+    case ENCODING_S24:
+      return 3;
+    case ENCODING_F64:
+      return 8;
+    default:
+      return 4;
+    }
+}
+
+// read a little endian number of some bytes out of a file
+uint64_t readLittle(const Uint8* bytes, int size)
+{
+  uint64_t value = 0;
+  int i;
+  for(i = size - 1; i >= 0; i--)
+    value = value << 8 | bytes[i];
+  return value;
+}
+
+// read a big endian number of some bytes out of a file
+uint64_t readBig(const Uint8* bytes, int size)
+{
+  uint64_t value = 0;
+  int i;
+  for(i = 0; i < size; i++)
+    value = value << 8 | bytes[i];
+  return value;
+}
+
+// read the 80 bit float aiff keeps its sample rate in
+double readExtended(const Uint8* bytes)
+{
+  int exponent = (bytes[0] & 0x7f) << 8 | bytes[1];
+  double value = ldexp(readBig(bytes + 2, 8), exponent - 16383 - 63);
+  return bytes[0] & 0x80 ? -value : value;
+}
+
+// find the samples in a riff wave file, or an rf64 one for files past 4gb
+// only plain integer and float samples are any good, the rest need ffmpeg
+// returns non-zero if it isnt one of those
+int parseWave(const Uint8* data, size_t size, struct pcmFormat* format)
+{
+  if(size < 12 || (memcmp(data, "RIFF", 4) != 0 && memcmp(data, "RF64", 4) != 0) ||
+     memcmp(data + 8, "WAVE", 4) != 0)
+    return -1;
+
+  uint64_t dataSize = 0; // from the ds64 chunk of rf64 files
+  int tag = -1, bits = 0, blockAlign = 0;
+  size_t position = 12;
+  while(position + 8 <= size)
+    {
+      const Uint8* body = data + position + 8;
+      uint64_t chunkSize = readLittle(data + position + 4, 4);
+      size_t available = size - position - 8;
+      if(memcmp(data + position, "ds64", 4) == 0 && available >= 24)
+	dataSize = readLittle(body + 8, 8);
+      else if(memcmp(data + position, "fmt ", 4) == 0 && available >= 16)
+	{
+	  tag = readLittle(body, 2);
+	  format->channels = readLittle(body + 2, 2);
+	  format->sampleRate = readLittle(body + 4, 4);
+	  blockAlign = readLittle(body + 12, 2);
+	  bits = readLittle(body + 14, 2);
+
+	  // extensible ones keep the real format at the start of the subformat guid
+	  if(tag == 0xfffe && chunkSize >= 40 && available >= 40)
+	    tag = readLittle(body + 24, 2);
+	}
+      else if(memcmp(data + position, "data", 4) == 0)
+	{
+	  if(tag == 1 && bits == 8) format->encoding = ENCODING_U8;
+	  else if(tag == 1 && bits == 16) format->encoding = ENCODING_S16;
+	  else if(tag == 1 && bits == 24) format->encoding = ENCODING_S24;
+	  else if(tag == 1 && bits == 32) format->encoding = ENCODING_S32;
+	  else if(tag == 3 && bits == 32) format->encoding = ENCODING_F32;
+	  else if(tag == 3 && bits == 64) format->encoding = ENCODING_F64;
+	  else return -1;
+	  format->bigEndian = 0;
+	  if(format->channels <= 0 || format->sampleRate <= 0 ||
+	     blockAlign != format->channels * bytesPerSample(format->encoding))
+	    return -1;
+
+	  // rf64 keeps the real size in the ds64 chunk
+	  // and a file cut short or still being written has less than it says
+	  if(chunkSize == 0xffffffff && dataSize > 0) chunkSize = dataSize;
+	  format->offset = position + 8;
+	  format->length = min(chunkSize, (uint64_t)available) / blockAlign;
+	  return 0;
+	}
+
+      // chunks are padded to an even size
+      position += 8 + chunkSize + (chunkSize & 1);
+    }
+  return -1;
+}
+
+// find the samples in an aiff file, or an aifc one that isnt really compressed
+// returns non-zero if it isnt one of those
+int parseAiff(const Uint8* data, size_t size, struct pcmFormat* format)
+{
+  if(size < 12 || memcmp(data, "FORM", 4) != 0 ||
+     (memcmp(data + 8, "AIFF", 4) != 0 && memcmp(data + 8, "AIFC", 4) != 0))
+    return -1;
+  int compressed = memcmp(data + 8, "AIFC", 4) == 0;
+
+  int found = 0;
+  uint64_t frames = 0;
+  size_t position = 12;
+  while(position + 8 <= size)
+    {
+      const Uint8* body = data + position + 8;
+      uint64_t chunkSize = readBig(data + position + 4, 4);
+      size_t available = size - position - 8;
+      if(memcmp(data + position, "COMM", 4) == 0 && available >= 18)
+	{
+	  format->channels = readBig(body, 2);
+	  frames = readBig(body + 2, 4);
+	  int bits = readBig(body + 6, 2);
+	  format->sampleRate = readExtended(body + 8);
+	  format->bigEndian = 1;
+	  if(bits == 8) format->encoding = ENCODING_S8;
+	  else if(bits == 16) format->encoding = ENCODING_S16;
+	  else if(bits == 24) format->encoding = ENCODING_S24;
+	  else if(bits == 32) format->encoding = ENCODING_S32;
+	  else if(!compressed) return -1;
+	  else format->encoding = -1;
+
+	  // aifc says how its compressed, which is sometimes not at all
+	  if(compressed)
+	    {
+	      if(available < 22) return -1;
+	      const Uint8* type = body + 18;
+	      if(memcmp(type, "sowt", 4) == 0)
+		format->bigEndian = 0;
+	      else if(memcmp(type, "fl32", 4) == 0 || memcmp(type, "FL32", 4) == 0)
+		format->encoding = ENCODING_F32;
+	      else if(memcmp(type, "fl64", 4) == 0 || memcmp(type, "FL64", 4) == 0)
+		format->encoding = ENCODING_F64;
+	      else if(memcmp(type, "NONE", 4) != 0 && memcmp(type, "twos", 4) != 0)
+		return -1;
+	    }
+	  if(format->encoding == -1 || format->channels <= 0 || format->sampleRate <= 0) return -1;
+	  found = 1;
+	}
+      else if(memcmp(data + position, "SSND", 4) == 0 && available >= 8)
+	{
+	  if(!found) return -1;
+	  format->offset = position + 16 + readBig(body, 4);
+	  if(format->offset > size) return -1;
+	  size_t frameSize = (size_t)bytesPerSample(format->encoding) * format->channels;
+	  format->length = min(frames, (uint64_t)(size - format->offset) / frameSize);
+	  return 0;
+	}
+
+      // chunks are padded to an even size
+      position += 8 + chunkSize + (chunkSize & 1);
+    }
+  return -1;
+}
+
+// work out the layout of a headerless file from a description like s16le:2:44100
+// returns non-zero if the description doesnt make sense
+int parseRaw(const char* description, size_t size, struct pcmFormat* format)
+{
+  char name[16];
+  if(sscanf(description, "%15[^:]:%d:%d", name, &format->channels, &format->sampleRate) != 3 ||
+     format->channels <= 0 || format->sampleRate <= 0)
+    return -1;
+  int i;
+  for(i = 0; i < PCM_ENCODINGS; i++)
+    if(strcmp(name, pcmEncodings[i].name) == 0) break;
+  if(i == PCM_ENCODINGS) return -1;
+  format->encoding = pcmEncodings[i].encoding;
+  format->bigEndian = pcmEncodings[i].bigEndian;
+  format->offset = 0;
+  format->length = size / ((size_t)bytesPerSample(format->encoding) * format->channels);
+  return 0;
+}
+
+// convert a run of samples in some uncompressed encoding to 16 bit ones
+// integers just keep their top two bytes and floats go through the float kernel
+void convertSamples(const Uint8* source, struct pcmFormat format, int length, int16_t* samples)
+{
+  int size = bytesPerSample(format.encoding);
+  int i;
+  switch(format.encoding)
+    {
+    case ENCODING_U8:
+      for(i = 0; i < length; i++)
+	samples[i] = (source[i] - 128) * 256;
+      break;
+    case ENCODING_S8:
+      for(i = 0; i < length; i++)
+	samples[i] = (int8_t)source[i] * 256;
+      break;
+    case ENCODING_S16:
+    case ENCODING_S24:
+    case ENCODING_S32:
+      {
+	// where the most significant byte is and which way the next one is from it
+	int top = format.bigEndian ? 0 : size - 1;
+	int next = format.bigEndian ? 1 : -1;
+	for(i = 0; i < length; i++, source += size)
+	  samples[i] = (int16_t)(source[top] << 8 | source[top + next]);
+	break;
+      }
+    default:
+      {
+	// little endian floats the cpu can read in place go straight to the kernel
+	if(format.encoding == ENCODING_F32 && !format.bigEndian &&
+	   SDL_BYTEORDER == SDL_LIL_ENDIAN && (uintptr_t)source % sizeof(float) == 0)
+	  {
+	    kernels.convertFloats((const float*)source, length, samples);
+	    break;
+	  }
+
+	// anything else gets put into floats a block at a time first
+	float floats[CONVERT_BLOCK_SIZE];
+	int start;
+	for(start = 0; start < length; start += CONVERT_BLOCK_SIZE)
+	  {
+	    int count = min(CONVERT_BLOCK_SIZE, length - start);
+	    for(i = 0; i < count; i++, source += size)
+	      {
+		uint64_t bits = format.bigEndian ? readBig(source, size) : readLittle(source, size);
+		if(format.encoding == ENCODING_F32)
+		  {
+		    uint32_t single = bits;
+		    memcpy(&floats[i], &single, sizeof(float));
+		  }
+		else
+		  {
+		    double value;
+		    memcpy(&value, &bits, sizeof(double));
+		    floats[i] = value;
+		  }
+	      }
+	    kernels.convertFloats(floats, count, samples + start);
+	  }
+	break;
+      }
+    }
+}
+
+// get where the decoded audio of a file would be cached
+// the name is a hash of the file's identity and how it was decoded
+// so a changed file or decoding never hits a stale entry
+int cachePath(const char* filename, char* path, size_t size)
+{
+  char resolved[PATH_MAX];
+  struct stat info;
+  if(realpath(filename, resolved) == NULL ||
+     stat(resolved, &info) ||
+     !S_ISREG(info.st_mode))
+    return -1;
+
+  // fnv-1a hash of everything that identifies the decoded samples
+  char key[PATH_MAX + 128];
+  snprintf(key, sizeof(key), "%s|%lld|%lld.%09ld|%s", resolved,
+	   (long long)info.st_size,
+	   (long long)info.st_mtim.tv_sec, info.st_mtim.tv_nsec,
+	   CACHE_FORMAT);
+  uint64_t hash = 14695981039346656037ULL;
+  const char* c;
+  for(c = key; *c; c++)
+    {
+      hash ^= (unsigned char)*c;
+      hash *= 1099511628211ULL;
+    }
+
+  char directory[PATH_MAX];
+  if(cacheDirectory(directory, sizeof(directory))) return -1;
+  snprintf(path, size, "%s/%016llx.pcm", directory, (unsigned long long)hash);
+  return 0;
+}
+
+// open a cache entry and read what the audio in it is like
+// returns a file descriptor or -1 if it isnt cached
+int openCachedAudio(const char* path, struct audioInfo* info)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return -1;
+  struct cacheHeader header;
+  if(read(fd, &header, sizeof(header)) != sizeof(header) ||
+     strncmp(header.format, CACHE_FORMAT, sizeof(header.format)) != 0 ||
+     header.channels <= 0 || header.sampleRate <= 0)
+    {
+      close(fd);
+      return -1;
+    }
+  info->channels = header.channels;
+  info->sampleRate = header.sampleRate;
+  info->duration = 0;
+  return fd;
+}
+
+// map the samples of an open cache entry into a buffer
+// returns the number of frames or -1 if it couldnt be mapped
+int64_t mapCachedAudio(int fd, const char* path, struct audioBuffer* buffer)
+{
+  int64_t length = mapChunkedArray(&buffer->samples, fd, CACHE_HEADER_SIZE);
+
+  // touch it so the eviction knows it was recently used
+  if(length > 0) utimensat(AT_FDCWD, path, NULL, 0);
+  close(fd);
+  return length;
+}
+
+// remove the least recently used entries until the cache fits its size limit
+void evictCache(const char* keep)
+{
+  char directory[PATH_MAX];
+  if(cacheDirectory(directory, sizeof(directory))) return;
+  DIR* dir = opendir(directory);
+  if(dir == NULL) return;
+
+  // see what's in there
+  struct cacheEntry
+  {
+    char path[PATH_MAX];
+    time_t used;
+    off_t size;
+  };
+  struct cacheEntry* entries = NULL;
+  int count = 0, capacity = 0;
+  off_t total = 0;
+  struct dirent* entry;
+  while((entry = readdir(dir)) != NULL)
+    {
+      const char* extension = strrchr(entry->d_name, '.');
+      if(extension == NULL || strcmp(extension, ".pcm") != 0) continue;
+      if(count == capacity)
+	{
+	  capacity = capacity ? capacity * 2 : 64;
+	  entries = (struct cacheEntry*)realloc(entries, capacity * sizeof(struct cacheEntry));
+	}
+      struct cacheEntry* cached = &entries[count];
+      struct stat info;
+      snprintf(cached->path, sizeof(cached->path), "%s/%s", directory, entry->d_name);
+      if(stat(cached->path, &info)) continue;
+      cached->used = info.st_mtime;
+      cached->size = info.st_size;
+      total += info.st_size;
+      count++;
+    }
+  closedir(dir);
+
+  // throw out the oldest until its small enough
+  off_t limit = (off_t)cliArgs.cacheSize * 1024 * 1024;
+  while(total > limit)
+    {
+      int oldest = -1;
+      int i;
+      for(i = 0; i < count; i++)
+	if(entries[i].size > 0 && strcmp(entries[i].path, keep) != 0 &&
+	   (oldest < 0 || entries[i].used < entries[oldest].used))
+	  oldest = i;
+      if(oldest < 0) break;
+      unlink(entries[oldest].path);
+      total -= entries[oldest].size;
+      entries[oldest].size = 0;
+    }
+  free(entries);
+}
+
+// finish off the cache entry being written
+// keeping it only if the whole file made it in
+void finishCaching(struct loader* loader, int complete)
+{
+  if(loader->cacheFile == NULL) return;
+
+  // samples going straight into the entry leave it as long as the chunks they filled
+  if(loader->paged)
+    complete = ftruncate(fileno(loader->cacheFile), CACHE_HEADER_SIZE + (off_t)loader->buffer->length *
+			 loader->buffer->samples.elementSize) == 0 && complete;
+  if(fclose(loader->cacheFile) == 0 && complete &&
+     rename(loader->cacheTempPath, loader->cachePath) == 0)
+    evictCache(loader->cachePath);
+  else
+    unlink(loader->cacheTempPath);
+  loader->cacheFile = NULL;
+}
+
+// start writing decoded audio to the cache as it comes in
+// it only gets its real name once the whole file has been decoded
+// the temporary name is unique so two loaders caching the same file dont write over each other
+void startCaching(struct loader* loader, struct audioBuffer buffer)
+{
+  snprintf(loader->cacheTempPath, sizeof(loader->cacheTempPath), "%s.XXXXXX", loader->cachePath);
+  int fd = mkstemp(loader->cacheTempPath);
+  if(fd < 0) return;
+  // its opened for reading too so the samples can be mapped from it
+  loader->cacheFile = fdopen(fd, "w+b");
+  if(loader->cacheFile == NULL)
+    {
+      close(fd);
+      unlink(loader->cacheTempPath);
+      return;
+    }
+
+  // the header says what the samples are, then padding up to where they start
+  char header[CACHE_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  struct cacheHeader* fields = (struct cacheHeader*)header;
+  strncpy(fields->format, CACHE_FORMAT, sizeof(fields->format));
+  fields->channels = buffer.channels;
+  fields->sampleRate = buffer.sampleRate;
+  if(fwrite(header, 1, sizeof(header), loader->cacheFile) != sizeof(header))
+    finishCaching(loader, 0);
+}
+
+// make an unnamed file in the cache directory, or the temporary one if thats not there
+// returns a file descriptor or -1 if it couldnt be made
+int temporaryFile()
+{
+  char path[PATH_MAX];
+  const char* temp = getenv("TMPDIR");
+  if(cacheDirectory(path, sizeof(path)))
+    snprintf(path, sizeof(path), "%s", temp != NULL ? temp : "/tmp");
+  strncat(path, "/paged.XXXXXX", sizeof(path) - strlen(path) - 1);
+  int fd = mkstemp(path);
+  if(fd >= 0) unlink(path);
+  return fd;
+}
+
+// keep the decoded samples in a file instead of memory when there are going to be too many of them
+// the cache entry being written is used for that if there is one, so the samples only get written once
+// anything else goes in an unnamed file that disappears along with the buffer
+void pageBuffer(struct loader* loader, struct audioBuffer* buffer)
+{
+  if((off_t)loader->expectedLength * buffer->samples.elementSize <= memoryBudget()) return;
+  int fd = -1;
+  off_t offset = 0;
+  if(loader->cacheFile != NULL && CACHE_HEADER_SIZE % sysconf(_SC_PAGESIZE) == 0 && fflush(loader->cacheFile) == 0)
+    {
+      fd = dup(fileno(loader->cacheFile));
+      offset = CACHE_HEADER_SIZE;
+    }
+  if(fd < 0)
+    fd = temporaryFile();
+  if(fd < 0)
+    {
+      fprintf(stderr, "Could not make a file for the samples, keeping them all in memory!\n");
+      return;
+    }
+  pageChunkedArray(&buffer->samples, fd, offset);
+  loader->paged = offset != 0;
+
+  // the prefix sums are four times the size so they cant stay in memory either
+  if(buffer->squareSums.index != NULL)
+    {
+      int sums = temporaryFile();
+      if(sums >= 0)
+	{
+	  // the first sum was already set so it has to move over to the file
+	  int64_t first[buffer->channels];
+	  memcpy(first, squareSumAt(*buffer, 0, 0), sizeof(first));
+	  freeChunkedArray(&buffer->squareSums);
+	  buffer->squareSums = createChunkedArray(sizeof(int64_t) * buffer->channels, SAMPLE_CHUNK_SHIFT, MAX_LENGTH + 1);
+	  pageChunkedArray(&buffer->squareSums, sums, 0);
+	  if(growChunkedArray(&buffer->squareSums, 0, 1) == 0)
+	    memcpy(squareSumAt(*buffer, 0, 0), first, sizeof(first));
+	}
+    }
+}
+
+// let the interface know the loader got further
+// these are rate limited except for the last one
+void notifyLoadProgress(struct loader* loader, int force)
+{
+  // theres no interface to tell when rendering pngs
+  if(loadProgressEvent == 0) return;
+  Uint32 now = SDL_GetTicks();
+  if(!force && now - loader->lastProgress < LOAD_PROGRESS_INTERVAL) return;
+  loader->lastProgress = now;
+
+  SDL_Event event;
+  SDL_memset(&event, 0, sizeof(event));
+  event.type = loadProgressEvent;
+  SDL_PushEvent(&event);
+}
+
+#ifdef WAVY_LIBAV
+// free everything a decoder has
+void closeDecoder(struct decoder* decoder)
+{
+  swr_free(&decoder->resampler);
+  av_frame_free(&decoder->frame);
+  av_packet_free(&decoder->packet);
+  avcodec_free_context(&decoder->codec);
+  avformat_close_input(&decoder->format);
+  free(decoder->pending);
+  free(decoder);
+}
+
+// open the first audio stream of a file with libav
+// the codec gets to use as many threads as it wants
+// returns NULL if it cant be decoded
+struct decoder* openDecoder(const char* filename, struct audioInfo* info)
+{
+  struct decoder* decoder = (struct decoder*)calloc(1, sizeof(struct decoder));
+  if(decoder == NULL) return NULL;
+  const AVCodec* codec = NULL;
+  if(avformat_open_input(&decoder->format, filename, NULL, NULL) < 0 ||
+     avformat_find_stream_info(decoder->format, NULL) < 0 ||
+     (decoder->stream = av_find_best_stream(decoder->format, AVMEDIA_TYPE_AUDIO, -1, -1, &codec, 0)) < 0 ||
+     (decoder->codec = avcodec_alloc_context3(codec)) == NULL ||
+     avcodec_parameters_to_context(decoder->codec, decoder->format->streams[decoder->stream]->codecpar) < 0)
+    {
+      closeDecoder(decoder);
+      return NULL;
+    }
+  decoder->codec->thread_count = 0;
+  decoder->codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  decoder->packet = av_packet_alloc();
+  decoder->frame = av_frame_alloc();
+  if(avcodec_open2(decoder->codec, codec, NULL) < 0 || decoder->packet == NULL || decoder->frame == NULL ||
+     decoder->codec->ch_layout.nb_channels <= 0 || decoder->codec->sample_rate <= 0)
+    {
+      closeDecoder(decoder);
+      return NULL;
+    }
+
+  // the container knows how long it is before anything gets decoded
+  AVStream* stream = decoder->format->streams[decoder->stream];
+  decoder->channels = decoder->codec->ch_layout.nb_channels;
+  info->channels = decoder->channels;
+  info->sampleRate = decoder->codec->sample_rate;
+  info->duration = 0;
+  if(stream->duration != AV_NOPTS_VALUE)
+    info->duration = stream->duration * av_q2d(stream->time_base);
+  else if(decoder->format->duration != AV_NOPTS_VALUE)
+    info->duration = (double)decoder->format->duration / AV_TIME_BASE;
+  return decoder;
+}
+
+// decode the next frame of audio into the pending frames
+// returns how many frames that was or -1 once there are no more
+int receiveFrames(struct decoder* decoder)
+{
+  // keep feeding packets in until a frame comes out
+  int result;
+  while((result = avcodec_receive_frame(decoder->codec, decoder->frame)) == AVERROR(EAGAIN))
+    {
+      if(decoder->flushed)
+	break;
+      result = av_read_frame(decoder->format, decoder->packet);
+      if(result < 0)
+	{
+	  decoder->failed = result != AVERROR_EOF;
+	  decoder->flushed = 1;
+	  avcodec_send_packet(decoder->codec, NULL);
+	  continue;
+	}
+      // a bad packet just gets skipped
+      if(decoder->packet->stream_index == decoder->stream)
+	avcodec_send_packet(decoder->codec, decoder->packet);
+      av_packet_unref(decoder->packet);
+    }
+  if(result < 0)
+    {
+      decoder->ended = result == AVERROR_EOF;
+      return -1;
+    }
+
+  // the buffer cant change shape halfway through
+  AVFrame* frame = decoder->frame;
+  if(frame->ch_layout.nb_channels != decoder->channels || frame->sample_rate != decoder->codec->sample_rate)
+    {
+      fprintf(stderr, "Audio changes format partway through!\n");
+      av_frame_unref(frame);
+      decoder->failed = 1;
+      return -1;
+    }
+  if(frame->nb_samples > decoder->pendingCapacity)
+    {
+      decoder->pendingCapacity = frame->nb_samples;
+      decoder->pending = (int16_t*)realloc(decoder->pending, (size_t)frame->nb_samples * decoder->channels * sizeof(int16_t));
+    }
+
+  // only convert when the codec gives out anything other than what gets played
+  int frames = frame->nb_samples;
+  if(frame->format == AV_SAMPLE_FMT_S16)
+    memcpy(decoder->pending, frame->data[0], (size_t)frames * decoder->channels * sizeof(int16_t));
+  else
+    {
+      if(decoder->resampler == NULL &&
+	 (swr_alloc_set_opts2(&decoder->resampler, &frame->ch_layout, AV_SAMPLE_FMT_S16, frame->sample_rate,
+			      &frame->ch_layout, frame->format, frame->sample_rate, 0, NULL) < 0 ||
+	  swr_init(decoder->resampler) < 0))
+	{
+	  fprintf(stderr, "Could not convert the decoded audio!\n");
+	  av_frame_unref(frame);
+	  decoder->failed = 1;
+	  return -1;
+	}
+      uint8_t* output = (uint8_t*)decoder->pending;
+      frames = swr_convert(decoder->resampler, &output, decoder->pendingCapacity,
+			   (const uint8_t**)frame->extended_data, frame->nb_samples);
+    }
+  av_frame_unref(frame);
+  decoder->pendingStart = 0;
+  decoder->pendingLength = max(frames, 0);
+  return decoder->pendingLength;
+}
+
+// decode up to a number of frames into some samples
+// returns how many it got, less than wanted only at the end
+int decodeAudio(struct decoder* decoder, int16_t* samples, int wanted)
+{
+  int count = 0;
+  while(count < wanted)
+    {
+      if(decoder->pendingLength == 0)
+	{
+	  if(receiveFrames(decoder) < 0) break;
+	  continue;
+	}
+      int span = min(wanted - count, decoder->pendingLength);
+      memcpy(samples + (size_t)count * decoder->channels,
+	     decoder->pending + (size_t)decoder->pendingStart * decoder->channels,
+	     (size_t)span * decoder->channels * sizeof(int16_t));
+      decoder->pendingStart += span;
+      decoder->pendingLength -= span;
+      count += span;
+    }
+  return count;
+}
+#endif
+
+// index newly loaded frames then let everyone else see them
+// returns non-zero if theres no memory for the index
+int indexFrames(struct loader* loader, int64_t newLength)
+{
+  struct audioBuffer* buffer = loader->buffer;
+  if((buffer->squareSums.index != NULL && extendSquareSums(buffer, newLength)) ||
+     extendSummary(loader->summary, *buffer, newLength))
+    {
+      fprintf(stderr, "Out of memory for audio after %lld frames!\n", (long long)buffer->length);
+      return -1;
+    }
+  int first = buffer->length == 0;
+  __atomic_store_n(&buffer->length, newLength, __ATOMIC_RELEASE);
+
+  // the first samples are enough to get going
+  if(first)
+    SDL_SemPost(loader->started);
+  notifyLoadProgress(loader, 0);
+  return 0;
+}
+
+// keep a copy of some frames in the cache for next time
+void cacheFrames(struct loader* loader, int64_t start, int64_t stop)
 {
-  // ignure key ups
-  if(event.key.type == SDL_KEYDOWN)
+  struct chunkedArray samples = loader->buffer->samples;
+  while(loader->cacheFile != NULL && !loader->paged && start < stop)
     {
-      // key events are all position by default
-      enum target target = getFinalTarget(PLAY);
-      
-      // get pixel coordinates
-      int width = mainSurface->w;
+      int span = min(stop - start, (int64_t)chunkRemaining(samples, start));
+      if(fwrite(chunkedElement(samples, start), samples.elementSize, span, loader->cacheFile) != span)
+	finishCaching(loader, 0);
+      start += span;
+    }
+}
 
-      // viewport stuff
-      int viewportStartSample = viewport.start;
-      int viewportEndSample = viewport.stop;
-      int sampleRange = viewportEndSample - viewportStartSample;
-      float samplesPerPixel = 1.0 * sampleRange / width;
-      int step = KEY_STEP_SCALE * samplesPerPixel;
-      
-      // which physical key?
-      // arrow keys
-      switch(target)
+// start an ffmpeg for each segment of a file
+// each one seeks a little before its segment then trims off exactly the frames before it
+// so the codec has settled by the time it gets there and the segments join up frame for frame
+// returns non-zero if they couldnt all be started
+int openSegments(struct loader* loader, const char* filename, struct audioInfo info, int count)
+{
+  loader->segments = (struct segment*)calloc(count, sizeof(struct segment));
+  if(loader->segments == NULL) return -1;
+  loader->segmentCount = count;
+  loader->segmentsStopped = 0;
+  loader->segmentProgress = SDL_CreateSemaphore(0);
+
+  int i;
+  for(i = 0; i < count; i++)
+    {
+      struct segment* segment = &loader->segments[i];
+      segment->loader = loader;
+      segment->start = loader->expectedLength * i / count;
+      int64_t stop = loader->expectedLength * (i + 1) / count;
+      segment->length = i == count - 1 ? MAX_LENGTH - segment->start : stop - segment->start;
+
+      // seek to a whole frame so the trimming counts from exactly there
+      int64_t seek = max(0, segment->start - SEGMENT_PREROLL * info.sampleRate);
+      char seekTime[32], trim[64], channels[16], rate[16];
+      snprintf(seekTime, sizeof(seekTime), "%.6f", (double)seek / info.sampleRate);
+      snprintf(trim, sizeof(trim), "atrim=start_sample=%lld", (long long)(segment->start - seek));
+      if(i < count - 1)
+	snprintf(trim + strlen(trim), sizeof(trim) - strlen(trim), ":end_sample=%lld", (long long)(stop - seek));
+      snprintf(channels, sizeof(channels), "%d", info.channels);
+      snprintf(rate, sizeof(rate), "%d", info.sampleRate);
+      // the seek only goes in when there is one
+      char* args[] = { "ffmpeg", "-hide_banner", "-loglevel", "panic", "-ss", seekTime, "-i", (char*)filename,
+		       "-af", trim, "-f", "s16le", "-ac", channels, "-ar", rate, "-", NULL };
+      if(seek == 0)
+	memmove(&args[4], &args[6], sizeof(args) - 6 * sizeof(args[0]));
+      segment->pipe = openProcess(args, 0, &segment->process);
+      if(segment->pipe == NULL)
 	{
-	case PLAY:
-	case REGION:
-	  switch(event.key.keysym.scancode)
+	  // no threads were started so the ones already open have to be closed here
+	  while(i-- > 0)
+	    closeProcess(loader->segments[i].pipe, loader->segments[i].process);
+	  free(loader->segments);
+	  loader->segments = NULL;
+	  SDL_DestroySemaphore(loader->segmentProgress);
+	  return -1;
+	}
+    }
+  return 0;
+}
+
+// a segment's thread
+// reads its ffmpeg's output straight into its place in the buffer
+int decodeSegment(void* data)
+{
+  struct segment* segment = (struct segment*)data;
+  struct loader* loader = segment->loader;
+  struct chunkedArray* samples = &loader->buffer->samples;
+  int64_t decoded = 0;
+  while(decoded < segment->length &&
+	!__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE) &&
+	!__atomic_load_n(&loader->segmentsStopped, __ATOMIC_ACQUIRE))
+    {
+      // everything up to the expected length was allocated up front
+      // so only the last segment grows the buffer and nobody else is using those chunks
+      int64_t position = segment->start + decoded;
+      int wanted = min((int64_t)LOAD_BLOCK_SIZE, segment->length - decoded);
+      if(growChunkedArray(samples, position, position + wanted))
+	{
+	  fprintf(stderr, "Out of memory for audio after %lld frames!\n", (long long)position);
+	  break;
+	}
+      wanted = min(wanted, chunkRemaining(*samples, position));
+      int count = fread(chunkedElement(*samples, position), samples->elementSize, wanted, segment->pipe);
+      if(count <= 0) break;
+      decoded += count;
+      __atomic_store_n(&segment->decoded, decoded, __ATOMIC_RELEASE);
+      SDL_SemPost(loader->segmentProgress);
+    }
+
+  // its only complete if ffmpeg got through all of it without trouble
+  int finished = decoded == segment->length || feof(segment->pipe);
+  segment->complete = (closeProcess(segment->pipe, segment->process) == 0) && finished;
+  __atomic_store_n(&segment->done, 1, __ATOMIC_RELEASE);
+  SDL_SemPost(loader->segmentProgress);
+  return 0;
+}
+
+// decode all the segments at once
+// and index them in order as they join up with each other
+void loadSegments(struct loader* loader)
+{
+  struct audioBuffer* buffer = loader->buffer;
+  int i;
+  for(i = 0; i < loader->segmentCount; i++)
+    {
+      struct segment* segment = &loader->segments[i];
+      segment->thread = SDL_CreateThread(decodeSegment, "segment", segment);
+      if(segment->thread == NULL)
+	{
+	  closeProcess(segment->pipe, segment->process);
+	  segment->done = 1;
+	}
+    }
+
+  int current = 0; // the first segment that isnt all indexed yet
+  int shortSegment = -1; // the first segment that ended before it should have
+  int stopped = 0;
+  while(current < loader->segmentCount && shortSegment < 0 && !stopped &&
+	!__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE))
+    {
+      SDL_SemWaitTimeout(loader->segmentProgress, LOAD_PROGRESS_INTERVAL);
+
+      // find how far the frames join up from the start now
+      int64_t joined = buffer->length;
+      while(current < loader->segmentCount)
+	{
+	  struct segment* segment = &loader->segments[current];
+	  int done = __atomic_load_n(&segment->done, __ATOMIC_ACQUIRE);
+	  int64_t decoded = __atomic_load_n(&segment->decoded, __ATOMIC_ACQUIRE);
+	  joined = segment->start + decoded;
+	  if(decoded < segment->length && !done) break;
+	  current++;
+
+	  // one that came up short leaves a gap so nothing after it can be used
+	  // which is fine if the file really ended there
+	  if(decoded < segment->length && current < loader->segmentCount)
 	    {
-	    case SDL_SCANCODE_RIGHT:
-	      setTargetPrimaryValue(target, getTargetValues(target).primary + step);
-	      break;
-	    case SDL_SCANCODE_LEFT:
-	      setTargetPrimaryValue(target, getTargetValues(target).primary - step);
-	      break;
-	    case SDL_SCANCODE_DOWN:
-	      setTargetSecondaryValue(target, getTargetValues(target).secondary - step);
-	      break;
-	    case SDL_SCANCODE_UP:
-	      setTargetSecondaryValue(target, getTargetValues(target).secondary + step);
+	      shortSegment = current - 1;
 	      break;
 	    }
-	  break;
-	case VIEWPORT:
-	  switch(event.key.keysym.scancode)
+	}
+
+      if(joined > buffer->length)
+	{
+	  cacheFrames(loader, buffer->length, joined);
+	  stopped = indexFrames(loader, joined) || stopped;
+	}
+    }
+
+  // wait for the rest, stopping them first if something went wrong
+  if(stopped)
+    __atomic_store_n(&loader->segmentsStopped, 1, __ATOMIC_RELEASE);
+  int complete = !stopped && !__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE);
+  for(i = 0; i < loader->segmentCount; i++)
+    {
+      if(loader->segments[i].thread != NULL)
+	SDL_WaitThread(loader->segments[i].thread, NULL);
+      complete = complete && loader->segments[i].complete;
+      if(shortSegment >= 0 && i > shortSegment && loader->segments[i].decoded > 0)
+	{
+	  fprintf(stderr, "Decoding stopped short at %lld frames, the rest is cut off!\n", (long long)buffer->length);
+	  shortSegment = -1;
+	  complete = 0;
+	}
+    }
+  finishCaching(loader, complete);
+  free(loader->segments);
+  loader->segments = NULL;
+  SDL_DestroySemaphore(loader->segmentProgress);
+}
+
+// the loader thread
+// reads blocks of samples from ffmpeg and indexes them
+// the new length is published only once everything up to it is ready
+int loadAudioThread(void* data)
+{
+  struct loader* loader = (struct loader*)data;
+  struct audioBuffer* buffer = loader->buffer;
+  int count;
+  int segmented = loader->segments != NULL;
+  if(segmented)
+    loadSegments(loader);
+  while(!segmented && !__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE))
+    {
+      int wanted = min((int64_t)LOAD_BLOCK_SIZE, MAX_LENGTH - buffer->length);
+      if(loader->source != NULL)
+	{
+	  // convert the next block straight out of the mapped file
+	  // up to the end of its chunk at most
+	  count = min((int64_t)wanted, loader->expectedLength - buffer->length);
+	  if(count <= 0) break;
+	  if(growChunkedArray(&buffer->samples, buffer->length, buffer->length + count))
 	    {
-	    case SDL_SCANCODE_UP:
-	      zoom(pixelCoordinateToSample(mainSurface->w / 2),
-		   KEY_ZOOM_SCALE);
-	      break;
-	    case SDL_SCANCODE_DOWN:
-	      zoom(pixelCoordinateToSample(mainSurface->w / 2),
-		   -KEY_ZOOM_SCALE);
+	      fprintf(stderr, "Out of memory for audio after %lld frames!\n", (long long)buffer->length);
 	      break;
-	    case SDL_SCANCODE_LEFT:
-	      pan(KEY_PAN_SCALE);
-	      break;
-	    case SDL_SCANCODE_RIGHT:
-	      pan(-KEY_PAN_SCALE);
+	    }
+	  count = min(count, chunkRemaining(buffer->samples, buffer->length));
+	  struct pcmFormat format = loader->sourceFormat;
+	  size_t frameSize = (size_t)bytesPerSample(format.encoding) * format.channels;
+	  convertSamples(loader->source + format.offset + buffer->length * frameSize, format,
+			 count * format.channels, sampleAt(*buffer, buffer->length));
+	}
+      else if(loader->pipe == NULL && loader->decoder == NULL)
+	{
+	  // the samples are all there already when they're from the cache
+	  // they just need indexing
+	  count = min((int64_t)wanted, loader->expectedLength - buffer->length);
+	}
+      else
+	{
+	  // make room for the next block
+	  // which is read up to the end of its chunk at most
+	  if(growChunkedArray(&buffer->samples, buffer->length, buffer->length + wanted))
+	    {
+	      fprintf(stderr, "Out of memory for audio after %lld frames!\n", (long long)buffer->length);
 	      break;
 	    }
-	  break;
+	  wanted = min(wanted, chunkRemaining(buffer->samples, buffer->length));
+	  int frameSize = buffer->samples.elementSize;
+#ifdef WAVY_LIBAV
+	  if(loader->decoder != NULL)
+	    count = decodeAudio(loader->decoder, sampleAt(*buffer, buffer->length), wanted);
+	  else
+#endif
+	    count = fread(sampleAt(*buffer, buffer->length), frameSize, wanted, loader->pipe);
+
+	  // and keep a copy in the cache for next time
+	  if(count > 0 && loader->cacheFile != NULL && !loader->paged &&
+	     fwrite(sampleAt(*buffer, buffer->length), frameSize, count, loader->cacheFile) != count)
+	    finishCaching(loader, 0);
 	}
-      
-      // now which virtual key?
-      // these are for mnemonic hotkeys
-      switch(event.key.keysym.sym)
+      if(count <= 0) break;
+
+      // index it before letting anyone else see it
+      if(indexFrames(loader, buffer->length + count))
+	break;
+    }
+
+  // only cache what ffmpeg fully decoded without being interrupted
+  if(loader->pipe != NULL)
+    {
+      int complete = !__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE) && feof(loader->pipe);
+      complete = (closeProcess(loader->pipe, loader->process) == 0) && complete;
+      finishCaching(loader, complete);
+    }
+#ifdef WAVY_LIBAV
+  if(loader->decoder != NULL)
+    {
+      int complete = !__atomic_load_n(&loader->cancelled, __ATOMIC_ACQUIRE) &&
+	loader->decoder->ended && !loader->decoder->failed;
+      closeDecoder(loader->decoder);
+      loader->decoder = NULL;
+      finishCaching(loader, complete);
+    }
+#endif
+
+  // done with the file being converted
+  if(loader->source != NULL)
+    {
+      munmap((void*)loader->source, loader->sourceSize);
+      loader->source = NULL;
+    }
+
+  // all done
+  // wake up the main thread too in case it never got any samples
+  __atomic_store_n(&loader->done, 1, __ATOMIC_RELEASE);
+  if(buffer->length == 0)
+    SDL_SemPost(loader->started);
+  notifyLoadProgress(loader, 1);
+  return 0;
+}
+
+// create an empty buffer to load audio into
+// the memory for the samples is allocated as they come in
+struct audioBuffer createAudioBuffer(struct audioInfo info)
+{
+  struct audioBuffer audioBuffer;
+  audioBuffer.channels = info.channels;
+  audioBuffer.sampleRate = info.sampleRate;
+  audioBuffer.format = AUDIO_S16SYS;
+  audioBuffer.samples = createChunkedArray(sizeof(int16_t) * info.channels, SAMPLE_CHUNK_SHIFT, MAX_LENGTH);
+  audioBuffer.length = 0;
+  audioBuffer.squareSums.index = NULL;
+  audioBuffer.references = (int*)malloc(sizeof(int));
+  *audioBuffer.references = 1;
+
+  // and the prefix sums if those are going to be used
+  // starting with the sums of nothing before the first frame
+  if(cliArgs.rmsMode == RMS_PREFIX)
+    {
+      audioBuffer.squareSums = createChunkedArray(sizeof(int64_t) * info.channels, SAMPLE_CHUNK_SHIFT, MAX_LENGTH + 1);
+      growChunkedArray(&audioBuffer.squareSums, 0, 1);
+      memset(squareSumAt(audioBuffer, 0, 0), 0, sizeof(int64_t) * info.channels);
+    }
+
+  // return the buffer struct
+  return audioBuffer;
+}
+
+// open an uncompressed file without ffmpeg
+// 16 bit little endian samples are used straight out of the file
+// anything else is left mapped for the loader to convert as it goes
+// returns the number of frames or -1 if it isnt a file that can be read like that
+int64_t loadPcmAudio(struct loader* loader, const char* filename, struct audioInfo* info)
+{
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return -1;
+  struct stat status;
+  if(fstat(fd, &status) || status.st_size == 0)
+    {
+      close(fd);
+      return -1;
+    }
+  Uint8* mapping = (Uint8*)mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) return -1;
+
+  // headerless files have to be described on the command line
+  struct pcmFormat format;
+  int parsed;
+  if(cliArgs.raw != NULL)
+    {
+      parsed = parseRaw(cliArgs.raw, status.st_size, &format);
+      if(parsed) fprintf(stderr, "Raw format should be like s16le:2:44100!\n");
+    }
+  else
+    parsed = parseWave(mapping, status.st_size, &format) && parseAiff(mapping, status.st_size, &format);
+  int64_t length = parsed ? 0 : min(format.length, MAX_LENGTH);
+  if(length <= 0)
+    {
+      munmap(mapping, status.st_size);
+      return -1;
+    }
+
+  info->channels = format.channels;
+  info->sampleRate = format.sampleRate;
+  info->duration = 0;
+  struct audioBuffer* buffer = loader->buffer;
+  *buffer = createAudioBuffer(*info);
+
+  // the samples are exactly what the buffer holds so the file can just be the buffer
+  if(format.encoding == ENCODING_S16 && !format.bigEndian &&
+     SDL_BYTEORDER == SDL_LIL_ENDIAN && format.offset % sizeof(int16_t) == 0)
+    {
+      if(adoptMapping(&buffer->samples, (char*)mapping, status.st_size, format.offset, length) == 0)
+	return length;
+      munmap(mapping, status.st_size);
+      releaseAudio(*buffer);
+      buffer->references = NULL;
+      return -1;
+    }
+
+  // otherwise the loader converts it a block at a time
+  madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+  loader->source = mapping;
+  loader->sourceSize = status.st_size;
+  loader->sourceFormat = format;
+  return length;
+}
+
+// load an audio file into the loader's buffer and summary
+// uncompressed files are read directly and everything else goes through ffmpeg
+// the loading carries on in a background thread
+// returns once there are some samples to show
+int loadAudioFromFile(const char* filename, struct loader* loader)
+{
+  struct audioBuffer* buffer = loader->buffer;
+  loader->thread = NULL;
+  loader->started = NULL;
+  loader->pipe = NULL;
+  loader->decoder = NULL;
+  loader->segments = NULL;
+  loader->cacheFile = NULL;
+  loader->source = NULL;
+  loader->paged = 0;
+  loader->done = 0;
+  loader->lastProgress = 0;
+  __atomic_store_n(&loader->cancelled, 0, __ATOMIC_RELEASE);
+  struct audioInfo info;
+
+  // uncompressed files dont need decoding or caching
+  int64_t length = loadPcmAudio(loader, filename, &info);
+  if(length <= 0 && cliArgs.raw != NULL) return -1;
+
+  // see if its been decoded before
+  int cached = length <= 0 && cliArgs.cache && cachePath(filename, loader->cachePath, sizeof(loader->cachePath)) == 0;
+  int fd = cached ? openCachedAudio(loader->cachePath, &info) : -1;
+  if(fd >= 0)
+    {
+      *buffer = createAudioBuffer(info);
+      length = mapCachedAudio(fd, loader->cachePath, buffer);
+      if(length <= 0)
 	{
-	case SDLK_SPACE:
-	  // play pause key
-	  togglePlaying();
-	  break;
-	case SDLK_l:
-	  // toggle looping
-	  toggleLooping();
-	  break;
-	case SDLK_e:
-	  // export selected snippet
-	  exportSnippet();
-	  break;
-	case SDLK_ESCAPE:
-	case SDLK_q:
-	  // quit
+	  releaseAudio(*buffer);
+	  buffer->references = NULL;
+	}
+    }
+  if(length > 0)
+    {
+      // no need for ffmpeg then
+      loader->expectedLength = length;
+
+      // but converting the samples puts them in memory unless theres a file for them
+      if(loader->source != NULL)
+	pageBuffer(loader, buffer);
+    }
+  else
+    {
+#ifdef WAVY_LIBAV
+      // decode it right here
+      // the channels, rate and length all come from the container up front
+      loader->decoder = openDecoder(filename, &info);
+      if(loader->decoder == NULL)
+	{
+	  fprintf(stderr, "Could not decode %s!\n", filename);
 	  return -1;
-	  break;
 	}
+      *buffer = createAudioBuffer(info);
+      loader->expectedLength = min(info.duration * info.sampleRate, (double)MAX_LENGTH);
+
+      // cache what comes out, and keep it out of memory if theres too much
+      if(cached) startCaching(loader, *buffer);
+      pageBuffer(loader, buffer);
+
+      // so all the memory for the samples can be had at once
+      if(loader->expectedLength > 0)
+	growChunkedArray(&buffer->samples, 0, loader->expectedLength);
+#else
+      // find out the channels and rate of the file so they can be kept as they are
+      // and how long it should be so progress can be shown
+      info = probeAudio(filename);
+      *buffer = createAudioBuffer(info);
+      loader->expectedLength = min(info.duration * info.sampleRate, (double)MAX_LENGTH);
+
+      // cache what comes out, and keep it out of memory if theres too much
+      if(cached) startCaching(loader, *buffer);
+      pageBuffer(loader, buffer);
+
+      // long files get decoded in segments at the same time
+      // which needs the memory for all of them up front so they can each fill in their part
+      int segments = min(cliArgs.segments > 0 ? cliArgs.segments : SDL_GetCPUCount(),
+			 (int)(info.duration / MIN_SEGMENT_DURATION));
+      if(segments > 1 && growChunkedArray(&buffer->samples, 0, loader->expectedLength) == 0)
+	{
+	  if(openSegments(loader, filename, info, segments)) return -1;
+	}
+      else
+	{
+	  // load the raw data from ffmpeg
+	  // as interleaved 16bit samples at the native channels and rate
+	  char channels[16], rate[16];
+	  snprintf(channels, sizeof(channels), "%d", info.channels);
+	  snprintf(rate, sizeof(rate), "%d", info.sampleRate);
+	  char* args[] = { "ffmpeg", "-hide_banner", "-loglevel", "panic", "-i", (char*)filename,
+			   "-f", "s16le", "-ac", channels, "-ar", rate, "-", NULL };
+	  loader->pipe = openProcess(args, 0, &loader->process);
+	  if(loader->pipe == NULL) return -1;
+	}
+#endif
+    }
+  *loader->summary = createSummary(MAX_LENGTH, info.channels);
+
+  // and let the loader thread take it from there
+  loader->started = SDL_CreateSemaphore(0);
+  loader->thread = SDL_CreateThread(loadAudioThread, "loader", loader);
+  if(loader->thread == NULL) return -1;
+  SDL_SemWait(loader->started);
+
+  // it was a dud if nothing came out at all
+  return loadedLength(buffer) == 0 ? -1 : 0;
+}
+
+// stop the loader thread if its still going
+void stopLoading()
+{
+  if(loader.thread == NULL) return;
+  __atomic_store_n(&loader.cancelled, 1, __ATOMIC_RELEASE);
+  SDL_WaitThread(loader.thread, NULL);
+  loader.thread = NULL;
+}
+
+// let go of everything a file was loaded into
+// its loader has to have stopped already
+void releaseTrack(struct loader* loader)
+{
+  if(loader->started != NULL)
+    SDL_DestroySemaphore(loader->started);
+  loader->started = NULL;
+  if(loader->buffer->references != NULL)
+    releaseAudio(*loader->buffer);
+  loader->buffer->references = NULL;
+  freeSummary(loader->summary);
+}
+
+// the prefetch thread
+// loads the whole of the next file of the playlist so its ready to go straight on into
+int prefetchThread(void* data)
+{
+  struct loader* next = &playlist.loader;
+  int failed = loadAudioFromFile(cliArgs.filenames[playlist.next], next);
+
+  // the cancel might have come before the loader was going
+  if(next->thread != NULL)
+    {
+      if(__atomic_load_n(&playlist.cancelled, __ATOMIC_ACQUIRE))
+	__atomic_store_n(&next->cancelled, 1, __ATOMIC_RELEASE);
+      SDL_WaitThread(next->thread, NULL);
+      next->thread = NULL;
     }
+  if(__atomic_load_n(&next->cancelled, __ATOMIC_ACQUIRE))
+    failed = 1;
+  __atomic_store_n(&playlist.prefetched, failed ? -1 : 1, __ATOMIC_RELEASE);
+
+  // wake the interface up to hand it over
+  notifyLoadProgress(next, 1);
+  return 0;
+}
+
+// start loading the file after the current one if it isnt already
+// only once the current one is all loaded so they arent fighting over the cpu
+void startPrefetch()
+{
+  int next = playlist.current + 1;
+  if(playlist.next >= 0 || next >= cliArgs.fileCount || !loadingDone()) return;
+  playlist.next = next;
+  playlist.prefetched = 0;
+  playlist.cancelled = 0;
+  playlist.loader.buffer = &playlist.buffer;
+  playlist.loader.summary = &playlist.summary;
+  playlist.prefetch = SDL_CreateThread(prefetchThread, "prefetch", NULL);
+  if(playlist.prefetch == NULL)
+    playlist.prefetched = -1;
+}
+
+// whether the next file has been loaded all the way
+// waiting for the prefetch thread once its done either way
+int prefetchDone()
+{
+  if(playlist.prefetch != NULL && __atomic_load_n(&playlist.prefetched, __ATOMIC_ACQUIRE) != 0)
+    {
+      SDL_WaitThread(playlist.prefetch, NULL);
+      playlist.prefetch = NULL;
+    }
+  return playlist.next >= 0 && playlist.prefetch == NULL && playlist.prefetched > 0;
+}
+
+// stop loading the next file ahead and let go of it
+// the audio callback mustnt be able to carry on into it anymore
+void cancelPrefetch()
+{
+  if(playlist.next < 0) return;
+  if(playlist.prefetch != NULL)
+    {
+      __atomic_store_n(&playlist.cancelled, 1, __ATOMIC_RELEASE);
+      __atomic_store_n(&playlist.loader.cancelled, 1, __ATOMIC_RELEASE);
+      SDL_WaitThread(playlist.prefetch, NULL);
+      playlist.prefetch = NULL;
+    }
+  __atomic_store_n(&transport.next, NULL, __ATOMIC_RELEASE);
+  releaseTrack(&playlist.loader);
+  playlist.next = -1;
+}
 
-  // return 0 to mean no quit
-  return 0;
+// give the audio callback a copy of the next file to carry straight on into
+// it goes in whichever of the copies the callback isnt playing
+// a file the device cant play as it is has to wait for the device to be opened again
+void handOffPrefetch()
+{
+  if(playlist.buffer.channels != audioBuffer.channels || playlist.buffer.sampleRate != audioBuffer.sampleRate)
+    return;
+  struct audioBuffer* playing = __atomic_load_n(&transport.buffer, __ATOMIC_ACQUIRE);
+  struct audioBuffer* handoff = &playlist.handoffs[playing == &playlist.handoffs[0]];
+  *handoff = playlist.buffer;
+  __atomic_store_n(&transport.next, handoff, __ATOMIC_RELEASE);
 }
 
-// handle mouse move events
-int handleMouseMotionEvent(SDL_Event event)
+// stop everything thats using the current file and let go of it
+void dropTrack()
 {
-  // this is for dragging events really
-  // so make appropriate mouse drag events out of this
-  int state = event.motion.state;
-  if(state & SDL_BUTTON_LMASK)
-    mouseDrag(event, PLAY);
-  if(state & SDL_BUTTON_RMASK)
-    mouseDrag(event, REGION);
-  if(state & SDL_BUTTON_MMASK)
-    mouseDrag(event, VIEWPORT);
-  
-  // return 0 for no quit event
-  return 0;
+  stopLoading();
+  stopSpectrogram();
+  releaseTrack(&loader);
 }
 
-// handle mouse button events
-int handleMouseButtonEvent(SDL_Event event)
+// show a file thats just become the current one from the start
+void showTrack()
 {
-  // ignore mouse ups
-  if(event.button.state == SDL_PRESSED)
+  free(pager.wanted);
+  pager.wanted = NULL;
+  wholeLength = expectedLength();
+  viewport.start = 0;
+  viewport.stop = wholeLength;
+  __atomic_store_n(&selection.start, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&selection.stop, 0, __ATOMIC_RELEASE);
+  if(showSpectrogram && startSpectrogram())
     {
-      // first set the target of the action by which button
-      enum target target;
-      switch(event.button.button)
-	{
-	case SDL_BUTTON_LEFT:
-	  target = PLAY;
-	  break;
-	case SDL_BUTTON_RIGHT:
-	  target = REGION;
-	  break;
-	case SDL_BUTTON_MIDDLE:
-	  target = VIEWPORT;
-	  break;
-	}
+      stopSpectrogram();
+      showSpectrogram = 0;
+    }
+  roughColumns.count = 0;
+  addDamage(&staleColumns, 0, mainSurface->w);
+  updateWindowTitle();
+  requestRedraw();
+}
 
-      // and then let it be modified with modifiers
-      target = getFinalTarget(target);
-      // do different things depending on the target
-      switch(target)
+// make the file that was loaded ahead the current one
+// the audio callback has to be playing a copy of it already or not be running
+void adoptPrefetch()
+{
+  dropTrack();
+  audioBuffer = playlist.buffer;
+  summary = playlist.summary;
+  loader = playlist.loader;
+  loader.buffer = &audioBuffer;
+  loader.summary = &summary;
+  playlist.buffer.references = NULL;
+  playlist.summary.levels = 0;
+  playlist.summary.level = NULL;
+  playlist.loader.started = NULL;
+  playlist.current = playlist.next;
+  playlist.next = -1;
+  showTrack();
+}
+
+// go some way along the playlist from the current file
+// the file loaded ahead is used if its the one wanted, otherwise it gets loaded now
+// files that wont load are skipped, and if none will the current one gets loaded again
+// returns -1 if even that doesnt work, or -2 if the audio device couldnt be opened again for the new file
+int changeTrack(int direction, int play)
+{
+  int file = playlist.current + direction;
+  if(file < 0 || file >= cliArgs.fileCount) return 0;
+
+  // pausing waits for the callback so it cant be using anything thats about to go
+  SDL_PauseAudioDevice(audioDevice, 1);
+  __atomic_store_n(&transport.switched, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&transport.next, NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&transport.buffer, NULL, __ATOMIC_RELAXED);
+  int channels = audioBuffer.channels;
+  int sampleRate = audioBuffer.sampleRate;
+  if(file == playlist.next && prefetchDone())
+    adoptPrefetch();
+  else
+    {
+      cancelPrefetch();
+      dropTrack();
+      while(loadAudioFromFile(cliArgs.filenames[file], &loader))
 	{
-	case PLAY:
-	  // set the play position
-	  setTargetPrimaryValue(target, getMouseSamplePosition(event));
-	  // grab mouse cursor
-	  SDL_SetRelativeMouseMode(1);
-	  break;
-	case REGION:
-	  // initiate a selection
-	  initiateSelection(getMouseSamplePosition(event));
-	  break;
-	case VIEWPORT:
-	  // grab mouse cursor
-	  SDL_SetRelativeMouseMode(1);
-	  break;
+	  stopLoading();
+	  releaseTrack(&loader);
+	  if(file == playlist.current) return -1;
+	  fprintf(stderr, "Could not load %s, skipping it!\n", cliArgs.filenames[file]);
+	  file += direction;
+	  if(file < 0 || file >= cliArgs.fileCount)
+	    file = playlist.current;
 	}
+      playlist.current = file;
+      showTrack();
     }
-  else
+
+  // start from the beginning
+  // the device has to be opened again for a file it cant play as it is
+  seek(0);
+  __atomic_store_n(&playing, play, __ATOMIC_RELEASE);
+  updateWindowTitle();
+  if(audioBuffer.channels != channels || audioBuffer.sampleRate != sampleRate)
     {
-      // release mouse cursor
-      SDL_SetRelativeMouseMode(0);
+      int size = playBufferSize;
+      SDL_CloseAudioDevice(audioDevice);
+      return openAudioDevice(size) ? -2 : 0;
     }
-  
-  // return 0 for no quit event
-  return 0;
-}
-
-// handle mouse wheel events
-int handleMouseWheelEvent(SDL_Event event)
-{
-  // mouse wheel is viewport by default
-  enum target target = getFinalTarget(VIEWPORT);
-
-  // do a general pan for how much was scrolled horizontally
-  pan(event.wheel.x * SCROLL_PAN_SCALE);
-  
-  // and a general zoom for how much was scrolled vertically
-  int x;
-  SDL_GetMouseState(&x, NULL);
-  zoom(pixelCoordinateToSample(x), event.wheel.y * SCROLL_ZOOM_SCALE);
-  
-  // return 0 for no quit event
+  SDL_PauseAudioDevice(audioDevice, !isPlaying());
+  __atomic_store_n(&stats.lastCallback, 0, __ATOMIC_RELAXED);
   return 0;
 }
 
-// process an SDL event
-int processEvent(SDL_Event event)
+// keep the playlist going
+// picks up the callback having carried on into the next file, goes wherever the interface asked to
+// and loads the next file ahead of time, handing it to the callback once its ready
+// returns -1 if nothing could be loaded or played
+int updatePlaylist()
 {
-  switch(event.type)
+  if(cliArgs.fileCount <= 1) return 0;
+  if(__atomic_exchange_n(&transport.switched, 0, __ATOMIC_ACQ_REL))
+    adoptPrefetch();
+  if(playlist.skip != 0)
     {
-    case SDL_KEYDOWN:
-    case SDL_KEYUP:
-      return handleKeyboardEvent(event);
-    case SDL_MOUSEMOTION:
-      return handleMouseMotionEvent(event);
-    case SDL_MOUSEBUTTONDOWN:
-    case SDL_MOUSEBUTTONUP:
-      return handleMouseButtonEvent(event);
-    case SDL_MOUSEWHEEL:
-      return handleMouseWheelEvent(event);
-    case SDL_WINDOWEVENT:
-      return handleWindowEvent(event);
-    case SDL_QUIT:
-      // return non-zero to mean exit
-      return -1;
+      int direction = playlist.skip;
+      playlist.skip = 0;
+      // the device already said why it couldnt be opened
+      int failure = changeTrack(direction, playlist.play);
+      if(failure == -1)
+	fprintf(stderr, "Could not load anything from the playlist!\n");
+      if(failure != 0)
+	return -1;
     }
-  // return 0 for no quit event
+  startPrefetch();
+  if(playlist.prefetch != NULL && prefetchDone())
+    handOffPrefetch();
   return 0;
 }
 
@@ -969,75 +6544,36 @@ void mainLoop()
   // wait for events until a quit event is received
   while(1)
     {
-      // when playing, we need to animate every frame
-      // if set that way anyways
-      if(ASYNC_PLAY_ANIMATION && playing)
+      // catch up with the audio callback
+      updatePlayback();
+      adaptPlayBuffer();
+      if(updatePlaylist()) break;
+      updatePaging();
+      updateStats();
+
+      // show whatever changed, at most once a frame
+      int wait = presentFrame();
+
+      // if theres a redraw waiting, only wait for events until it can happen
+      // when playing, we need to animate the playhead
+      // so dont wait for events any longer than a frame
+      // and the stats need updating every so often too
+      if(wait > 0 || isPlaying() || instrumenting)
 	{
-	  while(SDL_PollEvent(&event))
-	    {
-	      if(processEvent(event)) return;
-	    }
-	  // update the screen for the playhead
-	  redrawScreen();
+	  int timeout = wait > 0 ? wait : isPlaying() ? frameInterval : STATS_OVERLAY_INTERVAL;
+	  if(SDL_WaitEventTimeout(&event, timeout) &&
+	     processEvents(event))
+	    break;
 	}
       // otherwise just take events as they come
       else
 	{
 	  SDL_WaitEvent(&event);
-	  if(processEvent(event)) break;
+	  if(processEvents(event)) break;
 	}
     }
 }
 
-// save a buffer to an audio file using ffmpeg
-void saveAudioToFile(struct audioBuffer buffer, const char* filename)
-{
-  // save the raw data with ffmpeg
-  // for now just force mono and 16bit
-  char cmd[128];
-  sprintf(cmd, "ffmpeg -y -f s16le -ar 44100 -ac 1 -i - %s", filename);
-  FILE* pipe;
-  pipe = popen(cmd, "w");
-  fwrite(buffer.buffer, sizeof(uint16_t), buffer.length, pipe);
-  pclose(pipe);
-}
-
-// load an audio file into a buffer using ffmpeg
-struct audioBuffer loadAudioFromFile(const char* filename)
-{
-  // create a buffer to store the data
-  int16_t* buffer = (int16_t*)calloc(MAX_SAMPLES, sizeof(int16_t));
-  struct audioBuffer audioBuffer = { buffer, 0 };
-
-  // load the raw data from ffmpeg
-  // for now just force mono and 16bit
-  FILE* pipe;
-  char cmd[128];
-  sprintf(cmd, "ffmpeg -hide_banner -loglevel panic -i \"%s\" -f s16le -ac 1 -", filename);
-  
-  pipe = popen(cmd, "r");
-  audioBuffer.length = fread(buffer, sizeof(int16_t), MAX_SAMPLES, pipe);
-  pclose(pipe);
-
-  // return the buffer struct
-  return audioBuffer;
-}
-
-// export the selected region of audio to a tmp file
-void exportSnippet()
-{
-  // can only export a snippet if there's a selection to export
-  if(selectionExists())
-    {
-      int end = max(selection.start, selection.stop);
-      int start = min(selection.start, selection.stop);
-      int16_t* exportBuffer = audioBuffer.buffer + start;
-      int exportLength = end - start;
-      struct audioBuffer saveBuffer = { exportBuffer, exportLength };
-      saveAudioToFile(saveBuffer, EXPORT_FILE_NAME);
-    }
-}
-
 // load the given audio file from the cli
 // also init sdl audio stuff
 int initAudio()
@@ -1049,61 +6585,390 @@ int initAudio()
       return -1;
     }
   
-  // load the audio into the buffer
-  audioBuffer = loadAudioFromFile(cliArgs.filename);
-  if(audioBuffer.length == 0) return -1;
+  // start loading the audio into the buffer
+  // it gets summarized as it comes in so that zoomed out views dont have to touch every sample
+  loadProgressEvent = SDL_RegisterEvents(1);
+  exportProgressEvent = SDL_RegisterEvents(1);
+  spectrumEvent = SDL_RegisterEvents(1);
+  loader.buffer = &audioBuffer;
+  loader.summary = &summary;
+  if(loadAudioFromFile(cliArgs.filename, &loader)) return -1;
 
-  // init sdl audio
-  // copied from sdl wiki mostly
-  SDL_AudioSpec want, have;
-
-  // desired audio out format
-  SDL_memset(&want, 0, sizeof(want));
-  want.freq = 44100;
-  want.format = AUDIO_S16;
-  want.channels = 1;
-  want.samples = PLAY_BUFFER_SIZE;
-  want.callback = requestAudio;
+  // the rest of the playlist gets loaded ahead as it goes
+  playlist.current = 0;
+  playlist.next = -1;
 
-  // init the audio device
-  audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
-  if(audioDevice == 0)
+  // init sdl audio
+  // either the pinned size or the nearest power of two to the latency wanted
+  // which can grow later if the device cant keep up
+  int samples = cliArgs.bufferSize;
+  if(samples == 0)
     {
-      fprintf(stderr, "Failed to open audio: %s", SDL_GetError());
-      return -1;
+      double frames = cliArgs.latency * audioBuffer.sampleRate / 1000;
+      samples = min(max(1 << (int)lround(log2(max(frames, 1.0))), MIN_PLAY_BUFFER_SIZE),
+		    MAX_PLAY_BUFFER_SIZE);
     }
-  // unpause and have it poll all it wants muahuahuahuahuah
-  SDL_PauseAudioDevice(audioDevice, !cliArgs.autoplay);
-  
-  // it all went well
-  return 0;
+  return openAudioDevice(samples);
 }
 
 // initialize the interface state
 void initInterface()
 {
   // set the viewport to show the whole file
+  // as much as it's expected to be anyways while its still loading
+  wholeLength = expectedLength();
   viewport.start = 0;
-  viewport.stop = audioBuffer.length;
+  viewport.stop = wholeLength;
 
   // clear the selection
   selection.start = 0;
   selection.stop = 0;
 
   // set the audio cursor at the beginning
-  playPosition = 0;
+  seek(0);
 
   // set things from cli args
-  playing = cliArgs.autoplay;
-  looping = cliArgs.autoloop;
+  // the rate has to be there before playing starts
+  setPlaybackRate(cliArgs.rate);
+  __atomic_store_n(&playing, cliArgs.autoplay, __ATOMIC_RELEASE);
+  __atomic_store_n(&looping, cliArgs.autoloop, __ATOMIC_RELEASE);
+  SDL_PauseAudioDevice(audioDevice, !isPlaying());
+
+  // redraw as often as the display refreshes
+  SDL_DisplayMode mode;
+  frameInterval = PLAY_ANIMATION_INTERVAL;
+  if(SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(mainWindow), &mode) == 0 &&
+     mode.refresh_rate > 0)
+    frameInterval = max(1, 1000 / mode.refresh_rate);
 
   // update window title
   updateWindowTitle();
 
+  // start on the spectrogram if asked to
+  if(cliArgs.spectrogram)
+    toggleSpectrogram();
+
   // draw the screen for the first time
+  lastFrame = SDL_GetTicks();
   redrawScreen();
 }
 
+// write a big endian number
+void writeBig(Uint8* bytes, uint64_t value, int size)
+{
+  int i;
+  for(i = 0; i < size; i++)
+    bytes[i] = value >> (8 * (size - 1 - i));
+}
+
+// bits going into a deflate stream, lowest first
+struct bitWriter
+{
+  Uint8* bytes;
+  size_t length;
+  Uint32 bits; // bits not written out yet
+  int count;
+};
+
+// write some bits of a number, lowest first
+void writeBits(struct bitWriter* writer, Uint32 value, int count)
+{
+  writer->bits |= value << writer->count;
+  writer->count += count;
+  while(writer->count >= 8)
+    {
+      writer->bytes[writer->length++] = writer->bits;
+      writer->bits >>= 8;
+      writer->count -= 8;
+    }
+}
+
+// write a huffman code, which goes highest bit first
+void writeCode(struct bitWriter* writer, Uint32 code, int count)
+{
+  Uint32 reversed = 0;
+  int i;
+  for(i = 0; i < count; i++)
+    reversed |= ((code >> i) & 1) << (count - 1 - i);
+  writeBits(writer, reversed, count);
+}
+
+// write a literal byte or a length with the fixed huffman codes
+void writeSymbol(struct bitWriter* writer, int symbol)
+{
+  if(symbol < 144)
+    writeCode(writer, 0x30 + symbol, 8);
+  else if(symbol < 256)
+    writeCode(writer, 0x190 + symbol - 144, 9);
+  else if(symbol < 280)
+    writeCode(writer, symbol - 256, 7);
+  else
+    writeCode(writer, 0xc0 + symbol - 280, 8);
+}
+
+// the shortest length of each deflate length code and how many extra bits it has
+const int deflateLengths[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int deflateLengthBits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+				  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+// compress into a single deflate block with the fixed huffman codes
+// the only matches looked for are runs of the byte before
+// which is nearly all of a filtered waveform image, since its rows hardly differ
+// the output needs room for 9 bits a byte and a few more
+size_t deflateRuns(const Uint8* data, size_t length, Uint8* output)
+{
+  struct bitWriter writer = { output, 0, 0, 0 };
+  writeBits(&writer, 1, 1); // the last block
+  writeBits(&writer, 1, 2); // with the fixed codes
+  size_t i = 0;
+  while(i < length)
+    {
+      size_t run = 0;
+      while(i > 0 && run < 258 && i + run < length && data[i + run] == data[i - 1])
+	run++;
+      if(run < 3)
+	{
+	  writeSymbol(&writer, data[i++]);
+	  continue;
+	}
+      int code = 28;
+      while(deflateLengths[code] > run)
+	code--;
+      writeSymbol(&writer, 257 + code);
+      writeBits(&writer, run - deflateLengths[code], deflateLengthBits[code]);
+      writeCode(&writer, 0, 5); // a distance of one
+      i += run;
+    }
+  writeSymbol(&writer, 256);
+  writeBits(&writer, 0, 7);
+  return writer.length;
+}
+
+// carry a png crc on over some more bytes
+Uint32 updateCrc(Uint32 crc, const Uint8* bytes, size_t length)
+{
+  size_t i;
+  int bit;
+  for(i = 0; i < length; i++)
+    {
+      crc ^= bytes[i];
+      for(bit = 0; bit < 8; bit++)
+	crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+  return crc;
+}
+
+// write a chunk of a png
+int writePngChunk(FILE* file, const char* type, const Uint8* data, size_t length)
+{
+  Uint8 header[8], footer[4];
+  writeBig(header, length, 4);
+  memcpy(header + 4, type, 4);
+  Uint32 crc = updateCrc(updateCrc(0xffffffff, header + 4, 4), data, length);
+  writeBig(footer, ~crc, 4);
+  return fwrite(header, 1, 8, file) != 8 || fwrite(data, 1, length, file) != length ||
+    fwrite(footer, 1, 4, file) != 4;
+}
+
+// save a surface as an 8 bit rgb png
+// every row but the first is stored as its difference from the one above
+// returns non-zero if it couldnt be written
+int writePng(SDL_Surface* surface, const char* path)
+{
+  int width = surface->w;
+  int height = surface->h;
+  size_t rowSize = 1 + (size_t)width * 3;
+  size_t rawSize = rowSize * height;
+  Uint8* raw = (Uint8*)malloc(rawSize);
+  Uint8* compressed = (Uint8*)malloc(rawSize / 8 * 9 + 64);
+  if(raw == NULL || compressed == NULL)
+    {
+      free(raw);
+      free(compressed);
+      return -1;
+    }
+
+  // get the colors out of whatever format the surface is
+  if(SDL_MUSTLOCK(surface))
+    SDL_LockSurface(surface);
+  int x, y;
+  for(y = 0; y < height; y++)
+    {
+      Uint8* row = raw + rowSize * y;
+      const Uint8* pixels = (const Uint8*)surface->pixels + (size_t)surface->pitch * y;
+      int bytesPerPixel = surface->format->BytesPerPixel;
+      row[0] = y > 0 ? 2 : 0;
+      for(x = 0; x < width; x++)
+	{
+	  Uint32 pixel = 0;
+	  memcpy(&pixel, pixels + x * bytesPerPixel, bytesPerPixel);
+	  SDL_GetRGB(pixel, surface->format, &row[1 + x * 3], &row[2 + x * 3], &row[3 + x * 3]);
+	}
+    }
+  if(SDL_MUSTLOCK(surface))
+    SDL_UnlockSurface(surface);
+
+  // bottom up so the row above is still as it was
+  size_t i;
+  for(y = height - 1; y > 0; y--)
+    for(i = 1; i < rowSize; i++)
+      raw[rowSize * y + i] -= raw[rowSize * (y - 1) + i];
+
+  // a zlib stream around the deflate block
+  Uint32 a = 1, b = 0;
+  for(i = 0; i < rawSize; i++)
+    {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+  compressed[0] = 0x78;
+  compressed[1] = 0x01;
+  size_t length = 2 + deflateRuns(raw, rawSize, compressed + 2);
+  writeBig(compressed + length, (Uint32)b << 16 | a, 4);
+  length += 4;
+  free(raw);
+
+  Uint8 header[13];
+  writeBig(header, width, 4);
+  writeBig(header + 4, height, 4);
+  header[8] = 8; // bits per channel
+  header[9] = 2; // rgb
+  header[10] = header[11] = header[12] = 0;
+  FILE* file = fopen(path, "wb");
+  int failed = file == NULL;
+  if(file != NULL)
+    {
+      failed = fwrite("\x89PNG\r\n\x1a\n", 1, 8, file) != 8;
+      failed = failed || writePngChunk(file, "IHDR", header, sizeof(header));
+      failed = failed || writePngChunk(file, "IDAT", compressed, length);
+      failed = failed || writePngChunk(file, "IEND", NULL, 0);
+      failed = fclose(file) || failed;
+    }
+  free(compressed);
+  return failed;
+}
+
+// where the png for a file goes
+// %d in the pattern gets the number of the file and %s its name without the directory or extension
+void thumbnailPath(char* path, size_t size, const char* pattern, const char* filename, int number)
+{
+  char numbered[PATH_MAX];
+  exportPath(numbered, sizeof(numbered), pattern, number);
+  const char* nameAt = strstr(numbered, "%s");
+  if(nameAt == NULL)
+    {
+      snprintf(path, size, "%s", numbered);
+      return;
+    }
+  const char* name = strrchr(filename, '/');
+  name = name != NULL ? name + 1 : filename;
+  const char* extension = strrchr(name, '.');
+  int nameLength = extension != NULL && extension != name ? extension - name : (int)strlen(name);
+  snprintf(path, size, "%.*s%.*s%s", (int)(nameAt - numbered), numbered, nameLength, name, nameAt + 2);
+}
+
+// load a file and render the whole of its waveform to a png
+// a long file gets its samples put in a file of their own by the loader
+// and what the loader went through is dropped from memory as it goes
+// so only its summary and its share of the memory budget stay around
+int renderThumbnail(const char* filename, const char* path)
+{
+  struct audioBuffer buffer;
+  struct summary fileSummary = { 0, 0, NULL };
+  struct loader fileLoader;
+  memset(&fileLoader, 0, sizeof(fileLoader));
+  buffer.references = NULL;
+  fileLoader.buffer = &buffer;
+  fileLoader.summary = &fileSummary;
+  int failed = loadAudioFromFile(filename, &fileLoader);
+  if(!failed && chunkedArrayPaged(buffer.samples))
+    {
+      int64_t dropped = 0;
+      while(!__atomic_load_n(&fileLoader.done, __ATOMIC_ACQUIRE))
+	{
+	  SDL_Delay(RENDER_POLL_INTERVAL);
+	  int64_t loaded = loadedLength(&buffer) >> buffer.samples.shift;
+	  for(; dropped < loaded; dropped++)
+	    adviseChunk(buffer.samples, dropped, MADV_DONTNEED);
+	}
+    }
+  if(fileLoader.thread != NULL)
+    SDL_WaitThread(fileLoader.thread, NULL);
+
+  // the drawing happens right here since every thread is already busy with a file of its own
+  SDL_Surface* surface = NULL;
+  if(!failed)
+    surface = SDL_CreateRGBSurfaceWithFormat(0, cliArgs.renderWidth, cliArgs.renderHeight, 32, RENDER_FORMAT);
+  if(surface != NULL)
+    {
+      struct workerPool alone = { 1 };
+      struct region whole = { 0, buffer.length };
+      struct columnSpan columns = { 0, surface->w };
+      drawWaveform(&alone, surface, buffer, fileSummary, whole, columns);
+      failed = writePng(surface, path);
+      SDL_FreeSurface(surface);
+    }
+  else
+    failed = -1;
+  releaseTrack(&fileLoader);
+  return failed;
+}
+
+// render one of the files given
+// each band of the worker pool is a whole file so the threads take them as they finish the last
+void renderThumbnailBand(void* data, int band)
+{
+  int* failures = (int*)data;
+  const char* filename = cliArgs.filenames[band];
+  char path[PATH_MAX];
+  thumbnailPath(path, sizeof(path), cliArgs.renderPath, filename, band + 1);
+  if(renderThumbnail(filename, path))
+    {
+      fprintf(stderr, "Could not render %s to %s!\n", filename, path);
+      __atomic_add_fetch(failures, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// render the waveforms of all the files to pngs without a window or audio device
+// returns -1 if any of them couldnt be
+int renderThumbnails()
+{
+  if(cliArgs.fileCount == 0)
+    {
+      fprintf(stderr, "Please provide a filename!\n");
+      return -1;
+    }
+  if(cliArgs.fileCount > 1 && strstr(cliArgs.renderPath, "%d") == NULL && strstr(cliArgs.renderPath, "%s") == NULL)
+    {
+      fprintf(stderr, "Rendering more than one file needs a %%d or %%s in the png path!\n");
+      return -1;
+    }
+
+  // the files already keep every thread busy so long ones dont need splitting up too
+  if(cliArgs.segments == 0)
+    cliArgs.segments = 1;
+  // a batch of files would only push the ones opened to listen to out of the cache
+  cliArgs.cache = 0;
+  if(initKernels() || initWorkers(cliArgs.threads))
+    return -1;
+
+  // the colors get mapped before any of the threads want them
+  SDL_PixelFormat* format = SDL_AllocFormat(RENDER_FORMAT);
+  if(format == NULL)
+    {
+      fprintf(stderr, "Could not make a pixel format! SDL Error: %s\n", SDL_GetError());
+      return -1;
+    }
+  getPalette(format);
+  SDL_FreeFormat(format);
+
+  int failures = 0;
+  parallelFor(&workers, cliArgs.fileCount, renderThumbnailBand, &failures);
+  stopWorkers();
+  return failures > 0 ? -1 : 0;
+}
+
 // main program starts here!
 int main(int argc, const char* argv[])
 {
@@ -1114,6 +6979,18 @@ int main(int argc, const char* argv[])
       return -1;
     }
 
+  // just check the sample kernels if asked to
+  if(cliArgs.checkKernels)
+    return checkKernels();
+
+  // or just render pngs
+  if(cliArgs.renderPath != NULL)
+    return renderThumbnails();
+
+  // pick the sample kernels for this cpu
+  if(initKernels())
+    return -1;
+
   // then setup sdl
   if(initSDL())
     {
@@ -1122,6 +6999,10 @@ int main(int argc, const char* argv[])
       return -1;
     }
 
+  // start the threads that draw the waveform
+  if(initWorkers(cliArgs.threads))
+    return -1;
+
   // load the audio file and init playback buffer
   if(initAudio())
     {
@@ -1129,15 +7010,63 @@ int main(int argc, const char* argv[])
       return -1;
     }
 
+  // open the trace to record into or replay from
+  if(cliArgs.recordTrace != NULL || cliArgs.replayTrace != NULL)
+    {
+      const char* path = cliArgs.replayTrace != NULL ? cliArgs.replayTrace : cliArgs.recordTrace;
+      traceFile = fopen(path, cliArgs.replayTrace != NULL ? "r" : "w");
+      if(traceFile == NULL)
+	{
+	  fprintf(stderr, "Could not open trace file %s!\n", path);
+	  return -1;
+	}
+    }
+
+  // keep stats if asked to
+  // and dump them whenever SIGUSR1 comes in
+  if(cliArgs.stats || cliArgs.replayTrace != NULL)
+    instrumenting = 1;
+  if(cliArgs.stats)
+    signal(SIGUSR1, requestStatsDump);
+  stats.rateStart = SDL_GetTicks();
+
+  // an export going wrong shouldnt take everything down with it
+  signal(SIGPIPE, SIG_IGN);
+
   // init the interface state
   initInterface();
 
   // enter main loop
-  mainLoop();
+  // or replay a trace instead of waiting for real events
+  traceStart = SDL_GetTicks();
+  if(cliArgs.replayTrace != NULL)
+    replayLoop();
+  else
+    mainLoop();
+
+  // stop loading if it hasnt finished yet
+  // and the next file of the playlist too
+  stopLoading();
+  cancelPrefetch();
+
+  // let the exports get written out
+  finishExports();
+
+  // stop the drawing threads
+  stopSpectrogram();
+  stopWorkers();
 
   // cleanup sdl
   cleanupSDL();
 
+  // the audio callback is done now so its timings are settled
+  if(traceFile != NULL)
+    fclose(traceFile);
+  if(cliArgs.replayTrace != NULL)
+    reportTimings();
+  if(cliArgs.stats)
+    dumpStats(stdout);
+
   // we made it woohoo
   return 0;
 }